@@ -0,0 +1,602 @@
+#include "arithmetic.hpp"
+#include <cstdlib>
+#include <cctype>
+#include <cstring>
+
+/*----------------arithmeticParser Class-------------------------------*/
+/*
+ * arithmeticParser - turns the text of an expression into a tree of arithmeticExpression nodes
+ * It's a precedence climbing parser, it only lives for the duration of one compile() call
+ * Multi character operators are encoded above the char range so that every operator fits in a single int
+ */
+enum multiCharOperator {
+    OP_SHL = 256, OP_SHR, OP_LE, OP_GE, OP_EQ, OP_NE, OP_AND, OP_OR, OP_INCREMENT, OP_DECREMENT,
+    OP_ADD_ASSIGN, OP_SUB_ASSIGN, OP_MUL_ASSIGN, OP_DIV_ASSIGN, OP_MOD_ASSIGN,
+    OP_SHL_ASSIGN, OP_SHR_ASSIGN, OP_AND_ASSIGN, OP_XOR_ASSIGN, OP_OR_ASSIGN, OP_END
+};
+
+class arithmeticParser {
+    private:
+        typedef arithmeticExpression::node node;
+
+        const std::string &source;
+        size_t position;
+        bool failed;
+
+        void skipSpaces();
+        int peekOperator(size_t &length);
+        bool acceptOperator(int op);
+        std::unique_ptr<node> makeNode(arithmeticExpression::nodeType type, int op);
+        std::unique_ptr<node> fail();
+
+        std::unique_ptr<node> parseComma();
+        std::unique_ptr<node> parseAssignment();
+        std::unique_ptr<node> parseTernary();
+        std::unique_ptr<node> parseBinary(int level);
+        std::unique_ptr<node> parseUnary();
+        std::unique_ptr<node> parsePostfix();
+        std::unique_ptr<node> parsePrimary();
+
+    public:
+        arithmeticParser(const std::string &givenSource);
+        std::unique_ptr<node> parse();
+};
+
+arithmeticParser::arithmeticParser(const std::string &givenSource) : source(givenSource), position(0), failed(false) {
+
+}
+
+void arithmeticParser::skipSpaces() {
+    while (this->position < this->source.length() && std::isspace(static_cast<unsigned char>(this->source[this->position])))
+        this->position++;
+}
+
+/*
+ * peekOperator - returns the operator at the current position without consuming it
+ * The longest match wins, that's how "<<=" is never mistaken for "<<" followed by "="
+ */
+int arithmeticParser::peekOperator(size_t &length) {
+    static const struct { const char *text; int op; } operators[] = {
+        {"<<=", OP_SHL_ASSIGN}, {">>=", OP_SHR_ASSIGN},
+        {"<<", OP_SHL}, {">>", OP_SHR}, {"<=", OP_LE}, {">=", OP_GE}, {"==", OP_EQ}, {"!=", OP_NE},
+        {"&&", OP_AND}, {"||", OP_OR}, {"++", OP_INCREMENT}, {"--", OP_DECREMENT},
+        {"+=", OP_ADD_ASSIGN}, {"-=", OP_SUB_ASSIGN}, {"*=", OP_MUL_ASSIGN}, {"/=", OP_DIV_ASSIGN},
+        {"%=", OP_MOD_ASSIGN}, {"&=", OP_AND_ASSIGN}, {"^=", OP_XOR_ASSIGN}, {"|=", OP_OR_ASSIGN}
+    };
+
+    this->skipSpaces();
+    if (this->position >= this->source.length()) {
+        length = 0;
+        return OP_END;
+    }
+
+    for (const auto &candidate : operators) {
+        size_t candidateLength = std::strlen(candidate.text);
+        if (!this->source.compare(this->position, candidateLength, candidate.text)) {
+            length = candidateLength;
+            return candidate.op;
+        }
+    }
+
+    // Anything else is a single character operator, or the start of an operand
+    length = 1;
+    return static_cast<unsigned char>(this->source[this->position]);
+}
+
+bool arithmeticParser::acceptOperator(int op) {
+    size_t length;
+    if (this->peekOperator(length) != op)
+        return false;
+    this->position += length;
+    return true;
+}
+
+std::unique_ptr<arithmeticExpression::node> arithmeticParser::makeNode(arithmeticExpression::nodeType type, int op) {
+    std::unique_ptr<node> newNode(new node());
+    newNode->type = type;
+    newNode->op = op;
+    newNode->value = 0;
+    return newNode;
+}
+
+/*
+ * fail - reports where the parser gave up, only the first error is reported
+ */
+std::unique_ptr<arithmeticExpression::node> arithmeticParser::fail() {
+    if (!this->failed) {
+        std::cerr << "kamish: arithmetic syntax error near \"" << this->source.substr(this->position) << "\" in \"" << this->source << "\"" << std::endl;
+        this->failed = true;
+    }
+    return nullptr;
+}
+
+std::unique_ptr<arithmeticExpression::node> arithmeticParser::parse() {
+    size_t length;
+
+    // An empty expression is valid and evaluates to 0, just like "$(( ))" in bash
+    if (this->peekOperator(length) == OP_END)
+        return this->makeNode(arithmeticExpression::NUMBER, 0);
+
+    std::unique_ptr<node> root = this->parseComma();
+
+    // The whole text must be consumed, "1 2" is not an expression
+    if (root && this->peekOperator(length) != OP_END)
+        return this->fail();
+    return root;
+}
+
+std::unique_ptr<arithmeticExpression::node> arithmeticParser::parseComma() {
+    std::unique_ptr<node> left = this->parseAssignment();
+
+    while (left && this->acceptOperator(',')) {
+        std::unique_ptr<node> commaNode = this->makeNode(arithmeticExpression::COMMA, ',');
+        commaNode->left = std::move(left);
+        commaNode->right = this->parseAssignment();
+        if (!commaNode->right)
+            return nullptr;
+        left = std::move(commaNode);
+    }
+    return left;
+}
+
+/*
+ * parseAssignment - assignments are right associative, and their left side must be a plain variable
+ * The compound operators store the underlying binary operator, so "x += 2" evaluates like "x = x + 2"
+ */
+std::unique_ptr<arithmeticExpression::node> arithmeticParser::parseAssignment() {
+    std::unique_ptr<node> left = this->parseTernary();
+    if (!left)
+        return nullptr;
+
+    size_t length;
+    int op = this->peekOperator(length);
+    int binaryOp;
+
+    switch (op) {
+        case '=':           binaryOp = '='; break;
+        case OP_ADD_ASSIGN: binaryOp = '+'; break;
+        case OP_SUB_ASSIGN: binaryOp = '-'; break;
+        case OP_MUL_ASSIGN: binaryOp = '*'; break;
+        case OP_DIV_ASSIGN: binaryOp = '/'; break;
+        case OP_MOD_ASSIGN: binaryOp = '%'; break;
+        case OP_SHL_ASSIGN: binaryOp = OP_SHL; break;
+        case OP_SHR_ASSIGN: binaryOp = OP_SHR; break;
+        case OP_AND_ASSIGN: binaryOp = '&'; break;
+        case OP_XOR_ASSIGN: binaryOp = '^'; break;
+        case OP_OR_ASSIGN:  binaryOp = '|'; break;
+        default:
+            return left;
+    }
+
+    if (left->type != arithmeticExpression::VARIABLE)
+        return this->fail();
+    this->position += length;
+
+    std::unique_ptr<node> assignNode = this->makeNode(arithmeticExpression::ASSIGN, binaryOp);
+    assignNode->name = left->name;
+    assignNode->right = this->parseAssignment();
+    if (!assignNode->right)
+        return nullptr;
+    return assignNode;
+}
+
+std::unique_ptr<arithmeticExpression::node> arithmeticParser::parseTernary() {
+    std::unique_ptr<node> condition = this->parseBinary(0);
+    if (!condition || !this->acceptOperator('?'))
+        return condition;
+
+    std::unique_ptr<node> ternaryNode = this->makeNode(arithmeticExpression::TERNARY, '?');
+    ternaryNode->left = std::move(condition);
+    ternaryNode->middle = this->parseComma();
+    if (!ternaryNode->middle)
+        return nullptr;
+    if (!this->acceptOperator(':'))
+        return this->fail();
+    ternaryNode->right = this->parseAssignment();
+    if (!ternaryNode->right)
+        return nullptr;
+    return ternaryNode;
+}
+
+/*
+ * parseBinary - one function for every left associative binary level, from "||" (level 0) down to "*" (the last level)
+ * Each level parses its operands with the next level, which is what gives the operators their C precedence
+ */
+std::unique_ptr<arithmeticExpression::node> arithmeticParser::parseBinary(int level) {
+    static const std::vector<std::vector<int>> levels = {
+        {OP_OR}, {OP_AND}, {'|'}, {'^'}, {'&'}, {OP_EQ, OP_NE}, {'<', '>', OP_LE, OP_GE},
+        {OP_SHL, OP_SHR}, {'+', '-'}, {'*', '/', '%'}
+    };
+
+    if (level == static_cast<int>(levels.size()))
+        return this->parseUnary();
+
+    std::unique_ptr<node> left = this->parseBinary(level + 1);
+
+    while (left) {
+        size_t length;
+        int op = this->peekOperator(length);
+        bool found = false;
+
+        for (int candidate : levels[level])
+            if (candidate == op)
+                found = true;
+        if (!found)
+            break;
+        this->position += length;
+
+        arithmeticExpression::nodeType type = arithmeticExpression::BINARY;
+        if (op == OP_AND)
+            type = arithmeticExpression::LOGICAL_AND;
+        else if (op == OP_OR)
+            type = arithmeticExpression::LOGICAL_OR;
+
+        std::unique_ptr<node> binaryNode = this->makeNode(type, op);
+        binaryNode->left = std::move(left);
+        binaryNode->right = this->parseBinary(level + 1);
+        if (!binaryNode->right)
+            return nullptr;
+        left = std::move(binaryNode);
+    }
+    return left;
+}
+
+std::unique_ptr<arithmeticExpression::node> arithmeticParser::parseUnary() {
+    size_t length;
+    int op = this->peekOperator(length);
+
+    if (op == OP_INCREMENT || op == OP_DECREMENT) {
+        this->position += length;
+        std::unique_ptr<node> operand = this->parseUnary();
+        if (!operand)
+            return nullptr;
+        if (operand->type != arithmeticExpression::VARIABLE)
+            return this->fail();
+        operand->type = (op == OP_INCREMENT) ? arithmeticExpression::PRE_INCREMENT : arithmeticExpression::PRE_DECREMENT;
+        return operand;
+    }
+
+    if (op == '-' || op == '+' || op == '!' || op == '~') {
+        this->position += length;
+        std::unique_ptr<node> unaryNode = this->makeNode(arithmeticExpression::UNARY, op);
+        unaryNode->left = this->parseUnary();
+        if (!unaryNode->left)
+            return nullptr;
+        return unaryNode;
+    }
+
+    return this->parsePostfix();
+}
+
+std::unique_ptr<arithmeticExpression::node> arithmeticParser::parsePostfix() {
+    std::unique_ptr<node> operand = this->parsePrimary();
+    if (!operand || operand->type != arithmeticExpression::VARIABLE)
+        return operand;
+
+    if (this->acceptOperator(OP_INCREMENT))
+        operand->type = arithmeticExpression::POST_INCREMENT;
+    else if (this->acceptOperator(OP_DECREMENT))
+        operand->type = arithmeticExpression::POST_DECREMENT;
+    return operand;
+}
+
+/*
+ * parsePrimary - the leaves of the tree: numbers (decimal, 0x hexadecimal, 0 octal), variable names and parenthesized expressions
+ */
+std::unique_ptr<arithmeticExpression::node> arithmeticParser::parsePrimary() {
+    this->skipSpaces();
+    if (this->position >= this->source.length())
+        return this->fail();
+
+    if (this->acceptOperator('(')) {
+        std::unique_ptr<node> inner = this->parseComma();
+        if (!inner)
+            return nullptr;
+        if (!this->acceptOperator(')'))
+            return this->fail();
+        return inner;
+    }
+
+    const char *start = this->source.c_str() + this->position;
+    unsigned char c = static_cast<unsigned char>(*start);
+
+    if (std::isdigit(c)) {
+        char *end;
+        std::unique_ptr<node> numberNode = this->makeNode(arithmeticExpression::NUMBER, 0);
+        numberNode->value = static_cast<long long>(std::strtoull(start, &end, 0));
+
+        // Something like "09" or "12abc" is not a valid number
+        if (std::isalnum(static_cast<unsigned char>(*end)) || *end == '_')
+            return this->fail();
+        this->position += end - start;
+        return numberNode;
+    }
+
+    if (std::isalpha(c) || c == '_') {
+        size_t end = this->position;
+        while (end < this->source.length() && (std::isalnum(static_cast<unsigned char>(this->source[end])) || this->source[end] == '_'))
+            end++;
+
+        std::unique_ptr<node> variableNode = this->makeNode(arithmeticExpression::VARIABLE, 0);
+        variableNode->name = this->source.substr(this->position, end - this->position);
+        this->position = end;
+        return variableNode;
+    }
+
+    return this->fail();
+}
+
+
+/*----------------arithmeticExpression Class-------------------------------*/
+
+std::unordered_map<std::string, std::shared_ptr<arithmeticExpression>> arithmeticExpression::compiledCache;
+
+arithmeticExpression::arithmeticExpression(std::unique_ptr<node> compiledRoot) : root(std::move(compiledRoot)) {
+
+}
+
+/*
+ * compile - the only way to get an arithmeticExpression
+ * Looks the source up in the cache first, so a given text is parsed at most once per shell
+ */
+std::shared_ptr<arithmeticExpression> arithmeticExpression::compile(const std::string &source) {
+    auto cached = compiledCache.find(source);
+    if (cached != compiledCache.end())
+        return cached->second;
+
+    arithmeticParser parser(source);
+    std::unique_ptr<node> compiledRoot = parser.parse();
+    if (!compiledRoot)
+        return nullptr;
+
+    std::shared_ptr<arithmeticExpression> expression(new arithmeticExpression(std::move(compiledRoot)));
+    compiledCache[source] = expression;
+    return expression;
+}
+
+bool arithmeticExpression::evaluate(long long &result) const {
+    return this->evaluateNode(this->root.get(), result);
+}
+
+/*
+ * Small helpers to read and write variables, the environment is the only variable store the shell has
+ */
+static long long readVariable(const std::string &name) {
+    const char *value = std::getenv(name.c_str());
+    if (!value)
+        return 0;
+    return static_cast<long long>(std::strtoull(value, nullptr, 0));
+}
+
+static void writeVariable(const std::string &name, long long value) {
+    assignmentScope::noteAssignment(name);
+    setenv(name.c_str(), std::to_string(value).c_str(), 1);
+}
+
+/*
+ * applyBinary - the arithmetic of every binary operator, shared by BINARY nodes and compound assignments
+ * Unsigned arithmetic is used where signed overflow would be undefined, the results wrap around like they do in bash
+ */
+static bool applyBinary(int op, long long left, long long right, long long &result) {
+    unsigned long long uLeft = static_cast<unsigned long long>(left);
+    unsigned long long uRight = static_cast<unsigned long long>(right);
+
+    switch (op) {
+        case '+': result = static_cast<long long>(uLeft + uRight); return true;
+        case '-': result = static_cast<long long>(uLeft - uRight); return true;
+        case '*': result = static_cast<long long>(uLeft * uRight); return true;
+        case '/':
+        case '%':
+            if (!right) {
+                std::cerr << "kamish: arithmetic: division by zero" << std::endl;
+                return false;
+            }
+            // The one division that overflows, LLONG_MIN / -1
+            if (right == -1) {
+                result = (op == '/') ? static_cast<long long>(0 - uLeft) : 0;
+                return true;
+            }
+            result = (op == '/') ? left / right : left % right;
+            return true;
+        case OP_SHL: result = static_cast<long long>(uLeft << (uRight & 63)); return true;
+        case OP_SHR: result = left >> (uRight & 63); return true;
+        case '<':    result = left < right; return true;
+        case '>':    result = left > right; return true;
+        case OP_LE:  result = left <= right; return true;
+        case OP_GE:  result = left >= right; return true;
+        case OP_EQ:  result = left == right; return true;
+        case OP_NE:  result = left != right; return true;
+        case '&':    result = left & right; return true;
+        case '^':    result = left ^ right; return true;
+        case '|':    result = left | right; return true;
+    }
+    return false;
+}
+
+bool arithmeticExpression::evaluateNode(const node *current, long long &result) const {
+    long long left, right;
+
+    switch (current->type) {
+        case NUMBER:
+            result = current->value;
+            return true;
+
+        case VARIABLE:
+            result = readVariable(current->name);
+            return true;
+
+        case UNARY:
+            if (!this->evaluateNode(current->left.get(), left))
+                return false;
+            if (current->op == '-')
+                result = static_cast<long long>(0 - static_cast<unsigned long long>(left));
+            else if (current->op == '!')
+                result = !left;
+            else if (current->op == '~')
+                result = ~left;
+            else
+                result = left;
+            return true;
+
+        case BINARY:
+            if (!this->evaluateNode(current->left.get(), left) || !this->evaluateNode(current->right.get(), right))
+                return false;
+            return applyBinary(current->op, left, right, result);
+
+        // The logical operators short circuit, the right side only runs (and only assigns) when it has to
+        case LOGICAL_AND:
+            if (!this->evaluateNode(current->left.get(), left))
+                return false;
+            if (!left) {
+                result = 0;
+                return true;
+            }
+            if (!this->evaluateNode(current->right.get(), right))
+                return false;
+            result = right != 0;
+            return true;
+
+        case LOGICAL_OR:
+            if (!this->evaluateNode(current->left.get(), left))
+                return false;
+            if (left) {
+                result = 1;
+                return true;
+            }
+            if (!this->evaluateNode(current->right.get(), right))
+                return false;
+            result = right != 0;
+            return true;
+
+        case TERNARY:
+            if (!this->evaluateNode(current->left.get(), left))
+                return false;
+            return this->evaluateNode(left ? current->middle.get() : current->right.get(), result);
+
+        case ASSIGN:
+            if (!this->evaluateNode(current->right.get(), right))
+                return false;
+            if (current->op == '=')
+                result = right;
+            else if (!applyBinary(current->op, readVariable(current->name), right, result))
+                return false;
+            writeVariable(current->name, result);
+            return true;
+
+        case PRE_INCREMENT:
+        case PRE_DECREMENT:
+        case POST_INCREMENT:
+        case POST_DECREMENT: {
+            long long oldValue = readVariable(current->name);
+            long long step = (current->type == PRE_INCREMENT || current->type == POST_INCREMENT) ? 1 : -1;
+            long long newValue = static_cast<long long>(static_cast<unsigned long long>(oldValue) + static_cast<unsigned long long>(step));
+
+            writeVariable(current->name, newValue);
+            result = (current->type == PRE_INCREMENT || current->type == PRE_DECREMENT) ? newValue : oldValue;
+            return true;
+        }
+
+        case COMMA:
+            if (!this->evaluateNode(current->left.get(), left))
+                return false;
+            return this->evaluateNode(current->right.get(), result);
+    }
+    return false;
+}
+
+/*
+ * findClosingParens - "$((" opens two parentheses, the expansion ends when the depth falls back to zero
+ * Used by the tokenizer and the parser too, so an expression like "$(( a > b ))" is never split on its operators
+ */
+size_t arithmeticExpression::findClosingParens(const std::string &input, size_t startPos) {
+    int depth = 0;
+
+    for (size_t i = startPos + 1; i < input.length(); i++) {
+        if (input[i] == '(')
+            depth++;
+        else if (input[i] == ')' && --depth == 0)
+            return i;
+    }
+    return std::string::npos;
+}
+
+/*
+ * expandWord - the arithmetic expansion stage, runs on every token right before the command executes
+ * Words without "$((" are copied as is, that's the common case and it costs a single find()
+ * A "$((" inside single quotes is plain text, like in bash, "echo '$(( 1 + 1 ))'" prints the expression itself
+ */
+bool arithmeticExpression::expandWord(const std::string &word, std::string &expandedWord, const literalRanges &literals) {
+    size_t startPos = word.find("$((");
+    if (startPos == std::string::npos) {
+        expandedWord = word;
+        return true;
+    }
+
+    auto isLiteral = [&literals](size_t position) {
+        for (const auto &range : literals)
+            if (position >= range.first && position < range.second)
+                return true;
+        return false;
+    };
+
+    expandedWord.clear();
+    size_t copiedUpTo = 0;
+
+    while (startPos != std::string::npos) {
+        if (isLiteral(startPos)) {
+            startPos = word.find("$((", startPos + 1);
+            continue;
+        }
+
+        size_t endPos = findClosingParens(word, startPos);
+
+        // The expansion must end with "))", otherwise it's a syntax error
+        if (endPos == std::string::npos || word[endPos - 1] != ')') {
+            std::cerr << "kamish: unterminated arithmetic expansion in \"" << word << "\"" << std::endl;
+            return false;
+        }
+
+        // The expression is whatever sits between "$((" and "))"
+        std::shared_ptr<arithmeticExpression> expression = compile(word.substr(startPos + 3, endPos - startPos - 4));
+        long long value;
+        if (!expression || !expression->evaluate(value))
+            return false;
+
+        expandedWord += word.substr(copiedUpTo, startPos - copiedUpTo);
+        expandedWord += std::to_string(value);
+        copiedUpTo = endPos + 1;
+        startPos = word.find("$((", copiedUpTo);
+    }
+
+    expandedWord += word.substr(copiedUpTo);
+    return true;
+}
+
+
+/*----------------assignmentScope Class-------------------------------*/
+
+assignmentScope *assignmentScope::innermostScope = nullptr;
+
+assignmentScope::assignmentScope() : outerScope(innermostScope) {
+    innermostScope = this;
+}
+
+// The values are put back in reverse, so a variable assigned twice ends up with the value it had before the first assignment
+assignmentScope::~assignmentScope() {
+    for (auto previous = this->previousValues.rbegin(); previous != this->previousValues.rend(); ++previous) {
+        if (previous->second)
+            setenv(previous->first.c_str(), previous->second->c_str(), 1);
+        else
+            unsetenv(previous->first.c_str());
+    }
+    innermostScope = this->outerScope;
+}
+
+void assignmentScope::noteAssignment(const std::string &name) {
+    if (!innermostScope)
+        return;
+
+    const char *value = std::getenv(name.c_str());
+    std::unique_ptr<std::string> previousValue(value ? new std::string(value) : nullptr);
+    innermostScope->previousValues.emplace_back(name, std::move(previousValue));
+}
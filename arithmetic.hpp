@@ -0,0 +1,86 @@
+#ifndef __ARITHMETIC__
+#define __ARITHMETIC__
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+/*
+ * arithmeticExpression - a compiled integer expression, the engine behind "$(( ... ))" and the "let" builtin
+ * The source text is parsed exactly once into a small tree, and the compiled tree is cached by its text
+ * So evaluating the same expression a second time (a counter inside a loop body for example) never touches the parser again
+ * Variables live in the environment, reading an unset or non numeric variable yields 0, like every other shell
+ */
+class arithmeticExpression {
+    public:
+        // Every kind of node the parser can produce, the evaluator is one big switch over these
+        enum nodeType {
+            NUMBER, VARIABLE, UNARY, BINARY, LOGICAL_AND, LOGICAL_OR, TERNARY, ASSIGN,
+            PRE_INCREMENT, PRE_DECREMENT, POST_INCREMENT, POST_DECREMENT, COMMA
+        };
+
+        // A single node of the compiled tree, "op" holds the operator for UNARY, BINARY and compound ASSIGN nodes
+        // For a plain "=" assignment op is '='
+        struct node {
+            nodeType type;
+            int op;
+            long long value;
+            std::string name;
+            std::unique_ptr<node> left;
+            std::unique_ptr<node> middle;
+            std::unique_ptr<node> right;
+        };
+
+    private:
+        std::unique_ptr<node> root;
+
+        // The cache of already compiled expressions, keyed by their source text
+        static std::unordered_map<std::string, std::shared_ptr<arithmeticExpression>> compiledCache;
+
+        bool evaluateNode(const node *current, long long &result) const;
+
+    public:
+        arithmeticExpression(std::unique_ptr<node> compiledRoot);
+
+        // Returns the compiled form of the given source, parsing it only if it was never seen before
+        // Returns nullptr (after printing the reason) if the expression is malformed
+        static std::shared_ptr<arithmeticExpression> compile(const std::string &source);
+
+        // Evaluates the expression, assignments write back to the environment
+        // Returns false on a runtime error such as a division by zero
+        bool evaluate(long long &result) const;
+
+        // The [start, end) ranges of a word that were written inside single quotes, nothing in them is ever expanded
+        typedef std::vector<std::pair<size_t, size_t>> literalRanges;
+
+        // Replaces every "$(( ... ))" in the given word with its value, except the ones starting inside one of the literal ranges
+        // Returns false if any of the expressions failed to compile or to evaluate
+        static bool expandWord(const std::string &word, std::string &expandedWord, const literalRanges &literals = literalRanges());
+
+        // Returns the position of the ")" closing the "$((" that starts at the given position, or npos if it's never closed
+        static size_t findClosingParens(const std::string &input, size_t startPos);
+};
+
+/*
+ * assignmentScope - while one is alive, every variable an expression assigns is noted with its previous value,
+ * and everything is put back when it ends, for the expansions the shell does on behalf of a subshell, like a threaded pipeline stage
+ */
+class assignmentScope {
+    private:
+        // The previous values in assignment order, nullptr for a variable that wasn't set
+        std::vector<std::pair<std::string, std::unique_ptr<std::string>>> previousValues;
+        assignmentScope *outerScope;
+
+        static assignmentScope *innermostScope;
+
+    public:
+        assignmentScope();
+        ~assignmentScope();
+
+        // Called right before a variable is assigned, a no-op when no scope is alive
+        static void noteAssignment(const std::string &name);
+};
+
+#endif
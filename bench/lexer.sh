@@ -0,0 +1,46 @@
+#!/bin/sh
+# Lexer throughput on machine generated scripts: LINES lines of "echo" with LINE_KB kilobytes of arguments each
+# The script is run once per scanner level (KAMISH_SIMD=scalar|sse2|avx2), and once with BASELINE if one is given,
+# e.g. a build of an older revision, "echo" is a built-in so the time is the lexer, the parser and one write() per line
+# Build with -O2 for meaningful numbers, the vector code is left as is at -O0
+# Usage: bench/lexer.sh [KAMISH] [BASELINE] [LINE_KB] [LINES] [RUNS]
+KAMISH=${1:-./kamish}
+BASELINE=${2:-}
+LINE_KB=${3:-64}
+LINES=${4:-200}
+RUNS=${5:-5}
+
+exec python3 - "$KAMISH" "$BASELINE" "$LINE_KB" "$LINES" "$RUNS" <<'PYTHON'
+import os, random, subprocess, sys, tempfile, time
+
+kamish, baseline, lineKb, lines, runs = sys.argv[1], sys.argv[2], int(sys.argv[3]), int(sys.argv[4]), int(sys.argv[5])
+
+# Generated arguments look like what our generators emit: paths, options, quoted values and assignments
+random.seed(1)
+words = ["--input=/data/shard-%05d.bin", "'quoted value %d'", "\"x=%d\"", "/usr/local/lib/libfoo%d.so", "key%d=value"]
+script = tempfile.NamedTemporaryFile("w", suffix=".ksh", delete=False)
+for _ in range(lines):
+    line, length = ["echo"], 4
+    while length < lineKb * 1024:
+        word = random.choice(words) % random.randint(0, 99999)
+        line.append(word)
+        length += len(word) + 1
+    script.write(" ".join(line) + "\n")
+script.close()
+size = os.path.getsize(script.name)
+
+def measure(label, arguments, environment):
+    best = None
+    for _ in range(runs):
+        start = time.perf_counter()
+        subprocess.run(arguments + [script.name], check=True, env=environment, stdin=subprocess.DEVNULL, stdout=subprocess.DEVNULL)
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+    print("%-10s %8.1f MB/s  (%d lines of %d KB, best of %d: %.3f s)" % (label, size / best / 1e6, lines, lineKb, runs, best))
+
+for level in ("scalar", "sse2", "avx2"):
+    measure(level, [kamish, "--norc"], dict(os.environ, KAMISH_SIMD=level))
+if baseline:
+    measure("baseline", [baseline, "--norc"], dict(os.environ))
+os.unlink(script.name)
+PYTHON
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Throughput of the server mode: CLIENTS concurrent clients each send REQUESTS copies of the same command line
+# Usage: bench/serve_throughput.sh [KAMISH] [CLIENTS] [REQUESTS] [COMMAND]
+KAMISH=${1:-./kamish}
+CLIENTS=${2:-8}
+REQUESTS=${3:-1000}
+COMMAND=${4:-true}
+SOCKET=$(mktemp -u /tmp/kamish-bench.XXXXXX.sock)
+
+"$KAMISH" --serve "$SOCKET" &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null; rm -f "$SOCKET"' EXIT
+while [ ! -S "$SOCKET" ]; do sleep 0.05; done
+
+START=$(date +%s.%N)
+PIDS=""
+i=0
+while [ $i -lt "$CLIENTS" ]; do
+    "$KAMISH" --connect "$SOCKET" --repeat "$REQUESTS" "$COMMAND" > /dev/null 2>&1 &
+    PIDS="$PIDS $!"
+    i=$((i + 1))
+done
+wait $PIDS
+END=$(date +%s.%N)
+
+echo "$CLIENTS clients x $REQUESTS requests of \"$COMMAND\"" | awk -v start="$START" -v end="$END" -v total=$((CLIENTS * REQUESTS)) \
+    '{ seconds = end - start; printf "%s: %.2fs, %d requests/s\n", $0, seconds, total / seconds }'
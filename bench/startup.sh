@@ -0,0 +1,32 @@
+#!/bin/sh
+# Startup cost of the shell as a script interpreter: wall time and page faults of "kamish -c true"
+# Both with the rc file (through its snapshot) and without it, track these numbers across releases
+# Usage: bench/startup.sh [KAMISH] [RUNS]
+KAMISH=${1:-./kamish}
+RUNS=${2:-500}
+
+exec python3 - "$KAMISH" "$RUNS" <<'PYTHON'
+import os, resource, subprocess, sys, time
+
+kamish, runs = sys.argv[1], int(sys.argv[2])
+
+def measure(arguments):
+    wall = []
+    before = resource.getrusage(resource.RUSAGE_CHILDREN)
+    for _ in range(runs):
+        start = time.perf_counter()
+        subprocess.run(arguments, check=True, stdin=subprocess.DEVNULL)
+        wall.append(time.perf_counter() - start)
+    after = resource.getrusage(resource.RUSAGE_CHILDREN)
+
+    wall.sort()
+    minor = (after.ru_minflt - before.ru_minflt) / runs
+    major = (after.ru_majflt - before.ru_majflt) / runs
+    print("%-32s median %7.3f ms  p99 %7.3f ms  minor faults %7.1f  major faults %5.2f"
+          % (" ".join(arguments[1:]), wall[len(wall) // 2] * 1e3, wall[int(len(wall) * 0.99)] * 1e3, minor, major))
+
+# One warm up run, it also writes the rc snapshot if it's missing or stale
+subprocess.run([kamish, "-c", "true"], check=True)
+measure([kamish, "-c", "true"])
+measure([kamish, "--norc", "-c", "true"])
+PYTHON
@@ -0,0 +1,414 @@
+#include "builtins.hpp"
+#include "arithmetic.hpp"
+#include "supervisor.hpp"
+#include "stats.hpp"
+#include <sstream>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+
+bool builtinCommands::isBuiltin(const std::string &name) {
+    return name == "cd" || name == "let" || name == "timeout" || name == "stats" || isThreadSafe(name);
+}
+
+bool builtinCommands::isThreadSafe(const std::string &name) {
+    return name == "echo" || name == "printf" || name == "read" || name == ":";
+}
+
+bool builtinCommands::readsInput(const std::string &name) {
+    return name == "read";
+}
+
+int builtinCommands::run(const std::vector<std::string> &arguments, int inputFd, int outputFd, bool onThread) {
+    const std::string &name = arguments[0];
+
+    if (name == "cd")
+        return changeDirectory(arguments);
+    if (name == "let")
+        return let(arguments);
+    if (name == "timeout")
+        return timeout(arguments, outputFd);
+    if (name == "stats")
+        return stats(arguments, outputFd);
+    if (name == "echo")
+        return echo(arguments, outputFd);
+    if (name == "printf")
+        return printf(arguments, outputFd);
+    if (name == "read")
+        return read(arguments, inputFd, !onThread);
+    // ":" does nothing, successfully, whatever its arguments
+    if (name == ":")
+        return 0;
+    return 1;
+}
+
+bool builtinCommands::writeAll(int fd, const std::string &data) {
+    size_t written = 0;
+
+    while (written < data.length()) {
+        ssize_t count = write(fd, data.data() + written, data.length() - written);
+        if (count == -1) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        written += count;
+    }
+    return true;
+}
+
+/*
+ * reportWriteError - a reader that went away (EPIPE) is how pipelines normally end, "yes | head" style, so that one stays silent
+ */
+static int reportWriteError(const char *name) {
+    if (errno != EPIPE)
+        std::cerr << name << ": write error: " << std::strerror(errno) << std::endl;
+    return 1;
+}
+
+/*
+ * appendEscape - decodes the backslash escape starting at text[pos] into output, for "echo -e" and printf formats
+ * Returns the position of the last character of the escape, stop is set by "\c", which ends the output right there
+ */
+static size_t appendEscape(const std::string &text, size_t pos, std::string &output, bool &stop) {
+    if (pos + 1 >= text.length()) {
+        output += '\\';
+        return pos;
+    }
+
+    char escaped = text[++pos];
+    switch (escaped) {
+        case '\\': output += '\\'; return pos;
+        case 'a': output += '\a'; return pos;
+        case 'b': output += '\b'; return pos;
+        case 'f': output += '\f'; return pos;
+        case 'n': output += '\n'; return pos;
+        case 'r': output += '\r'; return pos;
+        case 't': output += '\t'; return pos;
+        case 'v': output += '\v'; return pos;
+        case 'c': stop = true; return pos;
+        default: break;
+    }
+
+    // Octal, "\0NNN" for echo and "\NNN" for printf, up to three digits either way
+    if (escaped >= '0' && escaped <= '7') {
+        if (escaped == '0' && pos + 1 < text.length() && text[pos + 1] >= '0' && text[pos + 1] <= '7')
+            pos++;
+        int value = 0;
+        size_t last = pos;
+        for (size_t digits = 0; digits < 3 && last < text.length() && text[last] >= '0' && text[last] <= '7'; digits++, last++)
+            value = value * 8 + (text[last] - '0');
+        output += static_cast<char>(value);
+        return last - 1;
+    }
+
+    // Not an escape after all, both characters are kept
+    output += '\\';
+    output += escaped;
+    return pos;
+}
+
+/*
+ * formatValue - one printf conversion, spec is the full conversion with the length modifier already in place, e.g. "%-8lld"
+ */
+template <typename T>
+static std::string formatValue(const std::string &spec, T value) {
+    int length = snprintf(nullptr, 0, spec.c_str(), value);
+    if (length <= 0)
+        return "";
+
+    std::string formatted(length + 1, '\0');
+    snprintf(&formatted[0], formatted.size(), spec.c_str(), value);
+    formatted.resize(length);
+    return formatted;
+}
+
+int builtinCommands::changeDirectory(const std::vector<std::string> &arguments) {
+    int result = 0;
+
+    if (arguments.size() == 1) {
+        const char *home = getenv("HOME");
+        if (home) {
+            result = chdir(home);
+        }
+        else {
+            perror("cd: HOME environment variable is not set");
+            return -1;
+        }
+    }
+    else if (arguments.size() == 2) {
+        result = chdir(arguments[1].c_str());
+    }
+    else {
+        perror("cd: Too many Arguments");
+    }
+    if (result) {
+        perror("cd failed: Can't change directory");
+    }
+    return 0;
+}
+
+/*
+ * let - each argument is an arithmetic expression evaluated in order
+ * Like bash, the status is 0 if the last expression is non zero, and 1 otherwise
+ */
+int builtinCommands::let(const std::vector<std::string> &arguments) {
+    if (arguments.size() == 1) {
+        std::cerr << "let: expression expected" << std::endl;
+        return 1;
+    }
+
+    long long value = 0;
+    for (size_t i = 1; i < arguments.size(); i++) {
+        std::shared_ptr<arithmeticExpression> expression = arithmeticExpression::compile(arguments[i]);
+        if (!expression || !expression->evaluate(value))
+            return 1;
+    }
+    return value ? 0 : 1;
+}
+
+/*
+ * timeout - "timeout --default", "timeout DURATION cmd" never gets here, the parser turns it into a timeoutCommand
+ * Without a duration it prints the current default, a duration of 0 turns the default timeout off
+ */
+int builtinCommands::timeout(const std::vector<std::string> &arguments, int outputFd) {
+    long long timeout;
+
+    if (arguments.size() == 2 && arguments[1] == "--default") {
+        if (!writeAll(outputFd, std::to_string(childSupervisor::getDefaultTimeout()) + "ms\n"))
+            return reportWriteError("timeout");
+        return 0;
+    }
+    if (arguments.size() != 3 || arguments[1] != "--default" || !childSupervisor::parseDuration(arguments[2], timeout)) {
+        std::cerr << "timeout: usage: timeout DURATION command, or timeout --default [DURATION]" << std::endl;
+        return 1;
+    }
+    childSupervisor::setDefaultTimeout(timeout);
+    return 0;
+}
+
+/*
+ * stats - prints the latencies recorded so far, as a table or as JSON for scraping
+ */
+int builtinCommands::stats(const std::vector<std::string> &arguments, int outputFd) {
+    std::ostringstream output;
+
+    if (arguments.size() == 1)
+        latencyStats::print(output);
+    else if (arguments.size() == 2 && arguments[1] == "--json")
+        latencyStats::printJson(output);
+    else if (arguments.size() == 2 && arguments[1] == "--reset")
+        latencyStats::reset();
+    else {
+        std::cerr << "stats: usage: stats [--json | --reset]" << std::endl;
+        return 1;
+    }
+
+    if (!writeAll(outputFd, output.str()))
+        return reportWriteError("stats");
+    return 0;
+}
+
+/*
+ * echo - "echo [-n] [-e] [-E] words...", the flags can be combined like "-ne", anything else is printed as a word
+ */
+int builtinCommands::echo(const std::vector<std::string> &arguments, int outputFd) {
+    bool newline = true, escapes = false, stop = false;
+    size_t i = 1;
+
+    for (; i < arguments.size(); i++) {
+        const std::string &flag = arguments[i];
+        if (flag.length() < 2 || flag[0] != '-' || flag.find_first_not_of("neE", 1) != std::string::npos)
+            break;
+        for (size_t j = 1; j < flag.length(); j++) {
+            if (flag[j] == 'n')
+                newline = false;
+            else
+                escapes = (flag[j] == 'e');
+        }
+    }
+
+    std::string output;
+    for (size_t first = i; i < arguments.size() && !stop; i++) {
+        if (i != first)
+            output += ' ';
+        if (!escapes) {
+            output += arguments[i];
+            continue;
+        }
+        for (size_t j = 0; j < arguments[i].length() && !stop; j++) {
+            if (arguments[i][j] == '\\')
+                j = appendEscape(arguments[i], j, output, stop);
+            else
+                output += arguments[i][j];
+        }
+    }
+    if (newline && !stop)
+        output += '\n';
+
+    if (!writeAll(outputFd, output))
+        return reportWriteError("echo");
+    return 0;
+}
+
+/*
+ * printf - "printf FORMAT [arguments...]", with the %d %i %u %o %x %X %c %s conversions, flags, width and precision
+ * Like bash, the format is used again and again as long as there are arguments left for it
+ */
+int builtinCommands::printf(const std::vector<std::string> &arguments, int outputFd) {
+    if (arguments.size() < 2) {
+        std::cerr << "printf: usage: printf FORMAT [arguments...]" << std::endl;
+        return 1;
+    }
+
+    const std::string &format = arguments[1];
+    size_t nextArgument = 2, firstArgument;
+    std::string output;
+    bool stop = false;
+    int status = 0;
+
+    do {
+        firstArgument = nextArgument;
+        for (size_t i = 0; i < format.length() && !stop; i++) {
+            if (format[i] == '\\') {
+                i = appendEscape(format, i, output, stop);
+                continue;
+            }
+            if (format[i] != '%') {
+                output += format[i];
+                continue;
+            }
+            if (i + 1 < format.length() && format[i + 1] == '%') {
+                output += '%';
+                i++;
+                continue;
+            }
+
+            // Flags, width and precision are handed to snprintf() as they are
+            size_t specStart = i++;
+            while (i < format.length() && std::strchr("-+ #0", format[i]))
+                i++;
+            while (i < format.length() && std::isdigit(static_cast<unsigned char>(format[i])))
+                i++;
+            if (i < format.length() && format[i] == '.') {
+                i++;
+                while (i < format.length() && std::isdigit(static_cast<unsigned char>(format[i])))
+                    i++;
+            }
+            if (i >= format.length() || !format[i]) {
+                std::cerr << "printf: " << format.substr(specStart) << ": missing format character" << std::endl;
+                return 1;
+            }
+
+            std::string spec = format.substr(specStart, i - specStart);
+            char conversion = format[i];
+            // Missing arguments count as empty strings, or 0 for the numeric conversions
+            std::string argument = (nextArgument < arguments.size()) ? arguments[nextArgument++] : "";
+            char *end = nullptr;
+
+            switch (conversion) {
+                case 'd':
+                case 'i':
+                    output += formatValue(spec + "lld", std::strtoll(argument.c_str(), &end, 0));
+                    break;
+                case 'u':
+                case 'o':
+                case 'x':
+                case 'X':
+                    output += formatValue(spec + "ll" + conversion, std::strtoull(argument.c_str(), &end, 0));
+                    break;
+                case 'c':
+                    output += formatValue(spec + "s", argument.substr(0, 1).c_str());
+                    break;
+                case 's':
+                    output += formatValue(spec + "s", argument.c_str());
+                    break;
+                default:
+                    std::cerr << "printf: %" << conversion << ": invalid format character" << std::endl;
+                    return 1;
+            }
+            if (end && *end) {
+                std::cerr << "printf: " << argument << ": invalid number" << std::endl;
+                status = 1;
+            }
+        }
+    } while (!stop && nextArgument > firstArgument && nextArgument < arguments.size());
+
+    if (!writeAll(outputFd, output))
+        return reportWriteError("printf");
+    return status;
+}
+
+/*
+ * read - "read [-r] [NAME...]", reads one line and splits it on blanks, the last name gets the rest of the line
+ * Without names the whole line goes to REPLY, without -r a backslash escapes the next character and joins continued lines
+ * When assignVariables is false (a pipeline stage on a thread) the line is consumed and dropped, just like bash's subshell would
+ */
+int builtinCommands::read(const std::vector<std::string> &arguments, int inputFd, bool assignVariables) {
+    bool raw = false, gotNewline = false, escaped = false;
+    size_t firstName = 1;
+    std::string line;
+    char character;
+
+    if (arguments.size() > 1 && arguments[1] == "-r") {
+        raw = true;
+        firstName = 2;
+    }
+
+    // One byte at a time, whatever follows the newline belongs to the next reader of the descriptor
+    while (true) {
+        ssize_t count = ::read(inputFd, &character, 1);
+        if (count == -1 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            break;
+
+        if (escaped) {
+            escaped = false;
+            if (character != '\n')
+                line += character;
+            continue;
+        }
+        if (!raw && character == '\\') {
+            escaped = true;
+            continue;
+        }
+        if (character == '\n') {
+            gotNewline = true;
+            break;
+        }
+        line += character;
+    }
+
+    // Like bash, hitting the end of the input is a failure, even if part of a line came before it
+    int status = gotNewline ? 0 : 1;
+    if (!assignVariables)
+        return status;
+
+    if (firstName == arguments.size()) {
+        setenv("REPLY", line.c_str(), 1);
+        return status;
+    }
+
+    size_t pos = 0;
+    for (size_t i = firstName; i < arguments.size(); i++) {
+        std::string value;
+        size_t start = line.find_first_not_of(" \t", pos);
+
+        if (start != std::string::npos) {
+            size_t end = (i + 1 == arguments.size()) ? line.find_last_not_of(" \t") + 1 : line.find_first_of(" \t", start);
+            if (end == std::string::npos)
+                end = line.length();
+            value = line.substr(start, end - start);
+            pos = end;
+        }
+        else {
+            pos = line.length();
+        }
+        setenv(arguments[i].c_str(), value.c_str(), 1);
+    }
+    return status;
+}
@@ -0,0 +1,42 @@
+#ifndef __BUILTINS__
+#define __BUILTINS__
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+/*
+ * builtinCommands - the commands the shell runs itself instead of looking them up in PATH
+ * Every built-in reads from and writes to the descriptors it's given rather than std::cin and std::cout,
+ * so the same code serves a plain "echo hi" (STDIN_FILENO and STDOUT_FILENO) and a pipeline stage running on a thread (the pipe ends)
+ */
+class builtinCommands {
+    private:
+        static int changeDirectory(const std::vector<std::string> &arguments);
+        static int let(const std::vector<std::string> &arguments);
+        static int timeout(const std::vector<std::string> &arguments, int outputFd);
+        static int stats(const std::vector<std::string> &arguments, int outputFd);
+        static int echo(const std::vector<std::string> &arguments, int outputFd);
+        static int printf(const std::vector<std::string> &arguments, int outputFd);
+        static int read(const std::vector<std::string> &arguments, int inputFd, bool assignVariables);
+
+    public:
+        static bool isBuiltin(const std::string &name);
+
+        // The built-ins that touch no shell state (no directory, no variables, no settings) and can run on a thread of their own
+        // "read" is one of them because on a thread it only consumes its line, it's a subshell in bash too, the variables never reach the shell
+        // "stats" is not, the shell records the latencies of the other stages while the pipeline runs, a forked child reads its own copy
+        static bool isThreadSafe(const std::string &name);
+
+        // The built-ins that read their input, first in a pipeline that's the shell's own stdin, see pipeCommand::execute()
+        static bool readsInput(const std::string &name);
+
+        // Runs the built-in named by arguments[0], onThread is set when it runs as a pipeline stage on a thread of the shell
+        static int run(const std::vector<std::string> &arguments, int inputFd, int outputFd, bool onThread = false);
+
+        // write() until everything is out, returns false on any error, EPIPE included
+        static bool writeAll(int fd, const std::string &data);
+};
+
+#endif
@@ -37,46 +37,131 @@ std::string Command::getAbsolutePath(const std::string &executableName) {
 }
 
 
+const executionLimits *Command::activeLimits = nullptr;
+
+/*
+ * forkProcess - a fork() that knows about the "with" built-in
+ * Scheduling settings and resource limits survive both fork() and execve(), so applying them right here in the child
+ * is all it takes for the executable to run under them, with no wrapper process in between
+ */
+pid_t Command::forkProcess() {
+    pid_t pid = fork();
+
+    // A command must never run with only half of what it asked for, if applying fails the child dies here
+    if (!pid && activeLimits && !activeLimits->apply())
+        exit(EXIT_FAILURE);
+    return pid;
+}
+
+
+const pid_t Command::shellPID = getpid();
+
+bool Command::startsJobGroups() {
+    return childSupervisor::getDefaultTimeout() > 0 && getpid() == shellPID;
+}
+
+/*
+ * joinProcessGroup - job control, both for the "timeout" built-in and for the jobs under a default timeout
+ * A background process calling tcsetpgrp() gets SIGTTOU, so it's ignored for the duration of the call
+ */
+void Command::joinProcessGroup(pid_t pid, pid_t leader, bool giveTerminal) {
+    if (!leader)
+        leader = pid ? pid : getpid();
+    setpgid(pid, leader);
+
+    if (giveTerminal) {
+        void (*previousHandler)(int) = signal(SIGTTOU, SIG_IGN);
+        tcsetpgrp(STDIN_FILENO, leader);
+        signal(SIGTTOU, previousHandler);
+    }
+}
+
+bool Command::ownsTerminal() {
+    return isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp();
+}
+
+void Command::reclaimTerminal() {
+    void (*previousHandler)(int) = signal(SIGTTOU, SIG_IGN);
+    tcsetpgrp(STDIN_FILENO, getpgrp());
+    signal(SIGTTOU, previousHandler);
+}
+
+
+/*
+ * optimizeTree - the entry point of the optimizer pass, swaps command for its cheaper equivalent if it has one
+ * Parse errors leave empty children behind, those are left for execute() to deal with
+ */
+void Command::optimizeTree(std::unique_ptr<Command> &command) {
+    if (!command)
+        return;
+
+    std::unique_ptr<Command> replacement = command->optimize();
+    if (replacement)
+        command = std::move(replacement);
+}
+
+void Command::explainTree(const std::unique_ptr<Command> &command, std::ostream &output, int depth) {
+    if (command)
+        command->explain(output, depth);
+    else
+        output << std::string(4 * depth, ' ') << "(empty)" << std::endl;
+}
+
+
 /*----------------simpleCommand Class-------------------------------*/
 
-simpleCommand::simpleCommand(const std::vector<std::string> &arguments) : argumentList(arguments) {
+simpleCommand::simpleCommand(const std::vector<std::string> &arguments, const std::vector<arithmeticExpression::literalRanges> &literals)
+    : argumentList(arguments), literalList(literals) {
+
+}
+
+/*
+ * expandArguments - the expansion stage, every "$(( ... ))" is replaced by its value before anything else looks at the arguments
+ * The parsed tree is kept untouched, so the same node can be executed again with fresh values
+ */
+bool simpleCommand::expandArguments(std::vector<std::string> &arguments) const {
+    arguments.clear();
+    arguments.reserve(this->argumentList.size());
+    for (size_t i = 0; i < this->argumentList.size(); i++) {
+        std::string expandedArgument;
+        const arithmeticExpression::literalRanges &literals = (i < this->literalList.size()) ? this->literalList[i] : arithmeticExpression::literalRanges();
+        if (!arithmeticExpression::expandWord(this->argumentList[i], expandedArgument, literals))
+            return false;
+        arguments.push_back(expandedArgument);
+    }
+    return true;
+}
+
+bool simpleCommand::runsOnThread() const {
+    return builtinCommands::isThreadSafe(this->argumentList[0]);
+}
 
+bool simpleCommand::readsInput() const {
+    return builtinCommands::readsInput(this->argumentList[0]);
 }
 
 int simpleCommand::execute(char **environ, bool shouldFork) {
+    static latencyHistogram &nodeLatency = latencyStats::node("simple");
+    latencyScope scope(nodeLatency);
 
-    if (this->argumentList[0] == "cd") {
-        int result = 0;
+    std::vector<std::string> arguments;
+    if (!this->expandArguments(arguments))
+        return 1;
 
-        if (this->argumentList.size() == 1) {
-            const char *home = getenv("HOME");
-            if (home) {
-                result = chdir(home);
-            }
-            else {
-                perror("cd: HOME environment variable is not set");
-                return -1;
-            }
-        }
-        else if (this->argumentList.size() == 2) {
-            result = chdir(this->argumentList[1].c_str());
-        }
-        else {
-            perror("cd: Too many Arguments");
-        }
-        if (result) {
-            perror("cd failed: Can't change directory");
-        }
-        return 0;
-    }
+    // Built-ins run right here, in the shell, or in the child that was forked for them if shouldFork is false
+    if (builtinCommands::isBuiltin(arguments[0]))
+        return builtinCommands::run(arguments, STDIN_FILENO, STDOUT_FILENO);
+
+    // Latencies are recorded under the name as it was typed, before it's resolved to a full path
+    std::string executableName = arguments[0];
 
     // Get the full path for the executable if possible
-    this->argumentList[0] = getAbsolutePath(this->argumentList[0]);
+    arguments[0] = getAbsolutePath(arguments[0]);
     // Create a C style vector since execve() doesn't understand C++ style strings
     std::vector<char *> cStyleArgs;
     
     // Loop through the argument list
-    for (const auto &argument : this->argumentList) {
+    for (const auto &argument : arguments) {
         // This line seems complicated, but what it does is convert the C++ arguments(string) into C style string (char *)
         // then store them in the C style vector.
         // c_str() effectively turns them back to (const char *), and const_cast<char *> removes the read only restriction
@@ -87,8 +172,14 @@ int simpleCommand::execute(char **environ, bool shouldFork) {
     cStyleArgs.push_back(nullptr);
 
     if (shouldFork) {
+        // Under a default timeout the child leads its own process group, and gets the terminal if the shell has it
+        bool newGroup = startsJobGroups();
+        bool giveTerminal = newGroup && ownsTerminal();
+
         // Start the child process by calling fork()
-        pid_t pid = fork();
+        latencyStats::prepareSpawn();
+        uint64_t forkTime = latencyStats::now();
+        pid_t pid = this->forkProcess();
 
         // If fork() failed, print an error and return -1 to the shell
         if (pid == -1) {
@@ -99,7 +190,11 @@ int simpleCommand::execute(char **environ, bool shouldFork) {
         // fork() returns 0 to the child process
         if (!pid) {
             // Call execve(), cStyleArgs.data() turns vector<char *> argv to char *argv[]
-            execve(cStyleArgs[0], cStyleArgs.data(), environ);
+            // The live environment is passed rather than the given one, "let" and "read" assign with setenv(), which may move the array
+            if (newGroup)
+                joinProcessGroup(0, 0, giveTerminal);
+            latencyStats::markExec();
+            execve(cStyleArgs[0], cStyleArgs.data(), ::environ);
             
             // execve() never returns, if we reach this line, execve() must've failed
             // This process must be killed to prevent to shells from running at the same time
@@ -109,9 +204,21 @@ int simpleCommand::execute(char **environ, bool shouldFork) {
 
         // fork() returns the child's PID to the parent
         else {
+            if (newGroup)
+                joinProcessGroup(pid, 0, giveTerminal);
+
             int status;
             // Pause the current process until the child process finishes to avoid having them both run at the same time
-            waitpid(pid, &status, 0);
+            uint64_t waitStart = latencyStats::now();
+            bool inTime = childSupervisor::waitForChild(pid, status);
+            uint64_t reapTime = latencyStats::now();
+            if (giveTerminal)
+                reclaimTerminal();
+
+            latencyStats::recordChild(executableName, pid, forkTime, waitStart, reapTime);
+            // Like the "timeout" built-in, 124 tells that the default timeout cut the command short
+            if (!inTime)
+                return 124;
             // If the child process exited naturally, return the status code to the shell
             if (WIFEXITED(status)) {
                 return WEXITSTATUS(status);
@@ -123,7 +230,9 @@ int simpleCommand::execute(char **environ, bool shouldFork) {
         }
     }
     else {
-        execve(cStyleArgs[0], cStyleArgs.data(), environ);
+        // Whoever forked this process (a pipe stage, a redirection) records its latencies, it needs the exec stamp too
+        latencyStats::markExec();
+        execve(cStyleArgs[0], cStyleArgs.data(), ::environ);
 
         perror("Execve Failed");
         exit(EXIT_FAILURE);
@@ -131,6 +240,50 @@ int simpleCommand::execute(char **environ, bool shouldFork) {
     return -1;
 }
 
+/*
+ * catsSingleFile - only "cat FILE" exactly, no options, no second file, no expansion
+ * The file itself is not looked at here, it may not even exist yet, the "cat" redirection checks it when it's opened
+ */
+bool simpleCommand::catsSingleFile(std::string &fileName) const {
+    if (this->argumentList.size() != 2 || this->argumentList[0] != "cat")
+        return false;
+
+    const std::string &argument = this->argumentList[1];
+    if (argument.empty() || argument[0] == '-' || argument.find("$((") != std::string::npos)
+        return false;
+
+    fileName = argument;
+    return true;
+}
+
+/*
+ * simpleCommand optimize function
+ * "true", "false" and ":" without arguments always end the same way, so the fork and the execve() are skipped altogether
+ */
+std::unique_ptr<Command> simpleCommand::optimize() {
+    if (this->argumentList.size() != 1)
+        return nullptr;
+
+    const std::string &name = this->argumentList[0];
+    if (name != "true" && name != ":" && name != "false")
+        return nullptr;
+
+    constantCommand *rawConstantPtr = new constantCommand(name == "false" ? 1 : 0);
+    std::unique_ptr<Command> genericCmdPtr(rawConstantPtr);
+    return genericCmdPtr;
+}
+
+void simpleCommand::explain(std::ostream &output, int depth) const {
+    output << std::string(4 * depth, ' ') << "simple:";
+    for (const auto &argument : this->argumentList)
+        output << " " << argument;
+    output << std::endl;
+}
+
+std::string simpleCommand::executableName() const {
+    return builtinCommands::isBuiltin(this->argumentList[0]) ? "" : this->argumentList[0];
+}
+
 /*----------------andCommand Class-------------------------------*/
 andCommand::andCommand(std::unique_ptr<Command> leftCommand, std::unique_ptr<Command> rightCommand) 
     : leftChild(std::move(leftCommand)), rightChild(std::move(rightCommand)) {
@@ -142,6 +295,9 @@ andCommand::andCommand(std::unique_ptr<Command> leftCommand, std::unique_ptr<Com
  * execute can trigger twice or more depending on the children, what matters is that the execute function is smart enough to tell
  */
 int andCommand::execute(char **environPtr, bool shouldFork) {
+    static latencyHistogram &nodeLatency = latencyStats::node("and");
+    latencyScope scope(nodeLatency);
+
     // Store the status of the first child execution
     int status = this->leftChild->execute(environPtr, true);
 
@@ -153,6 +309,26 @@ int andCommand::execute(char **environPtr, bool shouldFork) {
     return status;
 }
 
+/*
+ * andCommand optimize function
+ * A constant on the left decides on its own: "true && x" is just x, and in "false && x" x never runs, so it's just false
+ */
+std::unique_ptr<Command> andCommand::optimize() {
+    optimizeTree(this->leftChild);
+    optimizeTree(this->rightChild);
+
+    constantCommand *constantLeft = dynamic_cast<constantCommand *>(this->leftChild.get());
+    if (!constantLeft || !this->rightChild)
+        return nullptr;
+    return constantLeft->getStatus() ? std::move(this->leftChild) : std::move(this->rightChild);
+}
+
+void andCommand::explain(std::ostream &output, int depth) const {
+    output << std::string(4 * depth, ' ') << "and" << std::endl;
+    explainTree(this->leftChild, output, depth + 1);
+    explainTree(this->rightChild, output, depth + 1);
+}
+
 /*----------------andCommand Class-------------------------------*/
 pipeCommand::pipeCommand(std::unique_ptr<Command> leftCommand, std::unique_ptr<Command> rightCommand)
     : leftChild(std::move(leftCommand)), rightChild(std::move(rightCommand)) {
@@ -162,92 +338,206 @@ pipeCommand::pipeCommand(std::unique_ptr<Command> leftCommand, std::unique_ptr<C
 
 /*
  * pipeCommand execute function
- * The harderst one to implement, we have to redirect the standard output of the left child to the standard input of the right child
- * we will make use of pipe() to create a pipe, and dup2() to redirect input and output
- * We have to be careful since we will be forking twice, and we have to keep track of the status of each child to avoid zombies or pipe leaks
+ * The chain of pipe nodes is flattened into its stages and run in one go, "a | b | c" needs two pipes, one between each pair of stages
+ * Stages that are external programs (or anything that isn't a thread safe built-in) are forked, and exec directly since shouldFork is false
+ * Built-in stages run on threads of the shell, reading and writing the pipe ends themselves, so no process is created for them at all
+ * Every pipe end has exactly one owner, the stage that uses it, and the owner closes it when done, that's what makes EOF reach the next stage
  */
 int pipeCommand::execute(char **environPtr, bool shouldFork) {
-    // Create a new pipe that we will use to redirect output from the right child to the left one
-    int newPipe[2];
-
-    // Use pipe() to create a new pipe, newPipe[0] is where the right child will read from, newPipe[1] is where the left child will write to
-    if (pipe(newPipe) == -1) {
-        perror("Pipe Creation Failed");
-        return -1;
+    static latencyHistogram &nodeLatency = latencyStats::node("pipe");
+    latencyScope scope(nodeLatency);
+
+    // Only the right child can be another pipe, the parser splits on the first '|'
+    std::vector<Command *> stages;
+    Command *stage = this;
+    pipeCommand *nestedPipe;
+    while ((nestedPipe = dynamic_cast<pipeCommand *>(stage))) {
+        stages.push_back(nestedPipe->leftChild.get());
+        stage = nestedPipe->rightChild.get();
     }
-
-    // Start by forking and creating the left child process
-    pid_t leftProc = fork();
-
-    if (leftProc == -1) {
-        perror("Fork Failure");
-        return -1;
+    stages.push_back(stage);
+    size_t stageCount = stages.size();
+
+    // The arguments of the threaded stages are expanded here, arithmetic expansion must stay on the shell's own thread
+    // Every stage is a subshell though, so the variables it assigns are put back once it's expanded, like they are in a forked stage
+    // A stage whose expansion failed has already printed why, its thread only closes its pipe ends and reports the failure
+    // A "read" first in the pipeline is forked anyway, it reads the shell's own stdin, maybe a terminal, and a blocked thread
+    // can't be stopped by a timeout, the supervisor only knows how to kill children
+    std::vector<bool> threaded(stageCount, false);
+    std::vector<bool> expanded(stageCount, false);
+    std::vector<std::vector<std::string>> builtinArguments(stageCount);
+    for (size_t i = 0; i < stageCount; i++) {
+        simpleCommand *simpleStage = dynamic_cast<simpleCommand *>(stages[i]);
+        if (!simpleStage || !simpleStage->runsOnThread())
+            continue;
+        if (!i && simpleStage->readsInput())
+            continue;
+
+        assignmentScope stageScope;
+        threaded[i] = true;
+        expanded[i] = simpleStage->expandArguments(builtinArguments[i]);
     }
 
-    // If this is the left child
-    if (leftProc == 0) {
+    // pipeFds[2 * i] is read by stage i + 1, pipeFds[2 * i + 1] is written by stage i
+    // They are all close-on-exec, the forked stages only keep the two they dup2() over their STDIN and STDOUT
+    std::vector<int> pipeFds(2 * (stageCount - 1), -1);
+    for (size_t i = 0; i + 1 < stageCount; i++) {
+        if (pipe2(&pipeFds[2 * i], O_CLOEXEC) == -1) {
+            perror("Pipe Creation Failed");
+            for (int fd : pipeFds)
+                if (fd != -1)
+                    close(fd);
+            return -1;
+        }
+    }
+    auto inputOf = [&pipeFds](size_t i) { return i ? pipeFds[2 * (i - 1)] : STDIN_FILENO; };
+    auto outputOf = [&pipeFds, stageCount](size_t i) { return (i + 1 < stageCount) ? pipeFds[2 * i + 1] : STDOUT_FILENO; };
+
+    // Under a default timeout the forked stages share one process group, led by the first of them, so a timeout kills them all
+    // The terminal is only handed over when the first stage is forked, a threaded one reads it from the shell's own group
+    bool newGroup = startsJobGroups();
+    bool giveTerminal = newGroup && !threaded[0] && ownsTerminal();
+    pid_t groupLeader = 0;
+
+    // Fork every external stage first, before any thread exists
+    std::vector<int> stageStatuses(stageCount, -1);
+    std::vector<pid_t> children;
+    std::vector<size_t> childStages;
+    std::vector<uint64_t> forkTimes;
+    latencyStats::prepareSpawn();
+    for (size_t i = 0; i < stageCount; i++) {
+        if (threaded[i])
+            continue;
+
+        uint64_t forkTime = latencyStats::now();
+        pid_t childPID = this->forkProcess();
+        if (childPID == -1) {
+            perror("Fork Failure");
+            continue;
+        }
 
-        // dup2() basically renames/overwrites the standard output of te left child to use the pipe we created
-        // But because we have two ends to write to (the overwritten STDOUT, and newPipe[1]) we close newPipe[1]
-        // It's not an arbitrary choice, the left child knows only to write to STDOUT, so we trick it by overwriting STDOUT
-        dup2(newPipe[1], STDOUT_FILENO);
-        close(newPipe[0]);
-        close(newPipe[1]);
-        
-        
-        // When we call execute on the right child, and if its a simple command for example
-        // Its execute function will fork again, the resulting child will never return if successful
-        // But this child will return, because it's the parent process relative to the execute call()
-        exit(this->leftChild->execute(environPtr, false));
+        if (!childPID) {
+            if (newGroup)
+                joinProcessGroup(0, groupLeader, giveTerminal && !groupLeader);
+            // dup2() overwrites STDIN and STDOUT with this stage's pipe ends, then every pipe descriptor is closed,
+            // a stray write end left open anywhere would keep the next stage waiting for an EOF that never comes
+            if (inputOf(i) != STDIN_FILENO)
+                dup2(inputOf(i), STDIN_FILENO);
+            if (outputOf(i) != STDOUT_FILENO)
+                dup2(outputOf(i), STDOUT_FILENO);
+            for (int fd : pipeFds)
+                close(fd);
+
+            exit(stages[i]->execute(environPtr, false));
+        }
+        if (newGroup) {
+            joinProcessGroup(childPID, groupLeader, giveTerminal && !groupLeader);
+            if (!groupLeader)
+                groupLeader = childPID;
+        }
+        children.push_back(childPID);
+        childStages.push_back(i);
+        forkTimes.push_back(forkTime);
     }
-    
-    // Back to the parent, we fork again to create the right child process
-    pid_t rightProc = fork();
 
-    if (rightProc == -1) {
-        perror("Fork Failure");
-        return -1;
+    // The shell gives up the ends of the forked stages, the threads keep theirs and close them on their own
+    for (size_t i = 0; i + 1 < stageCount; i++) {
+        if (!threaded[i])
+            close(pipeFds[2 * i + 1]);
+        if (!threaded[i + 1])
+            close(pipeFds[2 * i]);
     }
-    
-    // If this is the right child
-    if (rightProc == 0) {
-
-        // dup2() basically renames/overwrites the standard input of te right child to use the pipe we created
-        // But because we have two ends to read from (the overwritten STDIN, and newPipe[0]) we close newPipe[0]
-        // It's not an arbitrary choice, the right child knows only to write to STDIN, so we trick it by overwriting STDIN
-        dup2(newPipe[0], STDIN_FILENO);
-        close(newPipe[0]);
-        close(newPipe[1]);
-        
-        exit(this->rightChild->execute(environPtr, false));
+
+    // A threaded stage writing to a stage that already exited must get EPIPE, SIGPIPE would take the whole shell down with it
+    // Nothing is forked while the threads run, so the children never inherit the ignored disposition
+    std::vector<std::thread> threads;
+    void (*previousHandler)(int) = SIG_DFL;
+    bool anyThreaded = std::find(threaded.begin(), threaded.end(), true) != threaded.end();
+    if (anyThreaded)
+        previousHandler = signal(SIGPIPE, SIG_IGN);
+
+    for (size_t i = 0; i < stageCount; i++) {
+        if (!threaded[i])
+            continue;
+        threads.emplace_back([&, i]() {
+            stageStatuses[i] = expanded[i] ? builtinCommands::run(builtinArguments[i], inputOf(i), outputOf(i), true) : 1;
+            if (inputOf(i) != STDIN_FILENO)
+                close(inputOf(i));
+            if (outputOf(i) != STDOUT_FILENO)
+                close(outputOf(i));
+        });
     }
 
-    // Back to the parent child again
-    int leftStatus, rightStatus;
+    // Wait for all the forked stages at once, whichever finishes first gets reaped first, then for the threads
+    bool inTime = true;
+    if (!children.empty()) {
+        std::vector<int> statuses;
+        std::vector<uint64_t> reapTimes;
+        uint64_t waitStart = latencyStats::now();
+        inTime = childSupervisor::waitForChildren(children, statuses, -1, &reapTimes);
+        for (size_t i = 0; i < children.size(); i++) {
+            stageStatuses[childStages[i]] = WIFEXITED(statuses[i]) ? WEXITSTATUS(statuses[i]) : -1;
+
+            // The stages that exec a program get their latencies recorded, the same as when they run on their own
+            std::string stageName = stages[childStages[i]]->executableName();
+            if (!stageName.empty())
+                latencyStats::recordChild(stageName, children[i], forkTimes[i], waitStart, reapTimes[i]);
+        }
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    if (anyThreaded)
+        signal(SIGPIPE, previousHandler);
+    if (giveTerminal)
+        reclaimTerminal();
+
+    // Like every shell, the status of a pipeline is the status of its last stage, or 124 if the default timeout cut it short
+    if (!inTime)
+        return 124;
+    return stageStatuses[stageCount - 1];
+}
 
-    // Crucial, we must close the pipes here or the right child will be waiting forever for input coming from the left child process
-    close(newPipe[0]);
-    close(newPipe[1]);
+/*
+ * pipeCommand optimize function
+ * "cat FILE | cmd" forks a cat only to copy FILE through a pipe, "cmd < FILE" gives cmd the file itself, one process and no copy
+ * When cmd is itself a pipeline, the redirection goes to its first stage, so "cat FILE | a | b" becomes "a < FILE | b"
+ */
+std::unique_ptr<Command> pipeCommand::optimize() {
+    optimizeTree(this->leftChild);
+    optimizeTree(this->rightChild);
+
+    simpleCommand *catStage = dynamic_cast<simpleCommand *>(this->leftChild.get());
+    std::string fileName;
+    if (!catStage || !this->rightChild || !catStage->catsSingleFile(fileName))
+        return nullptr;
+
+    std::unique_ptr<Command> *firstStage = &this->rightChild;
+    pipeCommand *rightPipe = dynamic_cast<pipeCommand *>(firstStage->get());
+    if (rightPipe)
+        firstStage = &rightPipe->leftChild;
+
+    // Wrapping the stage from the outside keeps any redirection it already had on top, "cat a | cmd < b" still reads b
+    // A "cat" redirection is a "read" one that fails like cat would, so the rewrite holds whatever happens to the file in between
+    redirectCommand *rawRedirectPtr = new redirectCommand(std::move(*firstStage), fileName, "cat");
+    std::unique_ptr<Command> genericCmdPtr(rawRedirectPtr);
+    *firstStage = std::move(genericCmdPtr);
+    optimizeTree(*firstStage);
+
+    return std::move(this->rightChild);
+}
 
-    // Wait for both children to finish to avoid creating two shells / or three
-    waitpid(leftProc, &leftStatus, 0);
-    waitpid(rightProc, &rightStatus, 0);
-    
-    // If the right status has exited succesfully, return the status, which will be 0 after conversion
-    if (WIFEXITED(rightStatus)) {
-        return WEXITSTATUS(rightStatus);
-    }
-    // Else, return -1
-    else {
-        return -1;
-    }
+void pipeCommand::explain(std::ostream &output, int depth) const {
+    output << std::string(4 * depth, ' ') << "pipe" << std::endl;
+    explainTree(this->leftChild, output, depth + 1);
+    explainTree(this->rightChild, output, depth + 1);
 }
 
 /*----------------redirectCommand Class-------------------------------*/
 
 redirectCommand::redirectCommand(std::unique_ptr<Command> givenCommand, const std::string &givenFileName, const std::string &redirectType) 
-    : command(std::move(givenCommand)), fileName(givenFileName), type(redirectType) {
-
+    : command(std::move(givenCommand)) {
+    this->redirections.push_back({givenFileName, redirectType});
 }
 /*
  * Another tough function to implement
@@ -257,41 +547,75 @@ redirectCommand::redirectCommand(std::unique_ptr<Command> givenCommand, const st
  * That way, we avoid forking twice for the same command, although it is not that serious, depends on what command we execute
  */
 int redirectCommand::execute(char **environPtr, bool shouldFork) {
-    // Create a direction flag that tells us if we replace STDIN or STDOUT
-    int fileDescriptor = -1;
-    int direction = -1;
-
-    // Open the file in the corresponding mode depending on the type of the redirect command
-    if (this->type == "trunc") {
-        fileDescriptor = open(this->fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        direction = 1;
-    }
-    else if(this->type == "append") {
-        fileDescriptor = open(this->fileName.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
-        direction = 1;
-    }
-    else if (this->type == "read") {
-        fileDescriptor = open(this->fileName.c_str(), O_RDONLY, 0644);
-        direction = 0;
-    }
-    else {
-        return -1;
-    }
+    static latencyHistogram &nodeLatency = latencyStats::node("redirect");
+    latencyScope scope(nodeLatency);
 
-    // If the file descriptor is still -1, this means opening the file failed
-    if (fileDescriptor == -1) {
-        perror("Error opening the file");
-        return -1;
+    // For each redirection, its file and a direction flag that tells us if we replace STDIN or STDOUT
+    std::vector<int> fileDescriptors;
+    std::vector<int> directions;
+
+    for (const auto &redirect : this->redirections) {
+        int fileDescriptor = -1;
+        int direction = -1;
+
+        // Open the file in the corresponding mode depending on the type of the redirection
+        if (redirect.type == "trunc") {
+            fileDescriptor = open(redirect.fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            direction = 1;
+        }
+        else if(redirect.type == "append") {
+            fileDescriptor = open(redirect.fileName.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+            direction = 1;
+        }
+        else if (redirect.type == "read") {
+            fileDescriptor = open(redirect.fileName.c_str(), O_RDONLY, 0644);
+            direction = 0;
+        }
+        // What the optimizer made of "cat FILE | cmd", when cat would have failed (no file, a directory...),
+        // it prints cat's error and cmd still runs, on an empty input, exactly like it would have after the failed cat
+        else if (redirect.type == "cat") {
+            struct stat fileStatus;
+            fileDescriptor = open(redirect.fileName.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fileDescriptor != -1 && !fstat(fileDescriptor, &fileStatus) && S_ISDIR(fileStatus.st_mode)) {
+                close(fileDescriptor);
+                fileDescriptor = -1;
+                errno = EISDIR;
+            }
+            if (fileDescriptor == -1) {
+                std::cerr << "cat: " << redirect.fileName << ": " << strerror(errno) << std::endl;
+                fileDescriptor = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            }
+            direction = 0;
+        }
+
+        // If the file descriptor is still -1, this means opening the file failed, the files opened so far are closed again
+        if (fileDescriptor == -1) {
+            if (direction != -1)
+                perror("Error opening the file");
+            for (int openedDescriptor : fileDescriptors)
+                close(openedDescriptor);
+            return -1;
+        }
+        fileDescriptors.push_back(fileDescriptor);
+        directions.push_back(direction);
     }
 
     // This is where we use the trick, hang on
     pid_t childPID;
+    // Under a default timeout the child leads its own process group, the same as a simple command
+    bool newGroup = shouldFork && startsJobGroups();
+    bool giveTerminal = newGroup && ownsTerminal();
     // If shouldFork is true, which is the default, we fork as usual
     // For example; if this execute function was called in AND execute chain, shouldFork would be true
+    uint64_t forkTime = 0;
     if (shouldFork) {
-        childPID = fork();
+        latencyStats::prepareSpawn();
+        forkTime = latencyStats::now();
+        childPID = this->forkProcess();
         if (childPID == -1) {
             perror("Failed to fork");
+            for (int fileDescriptor : fileDescriptors)
+                close(fileDescriptor);
             return -1;
 
         }
@@ -306,34 +630,84 @@ int redirectCommand::execute(char **environPtr, bool shouldFork) {
 
     // If this is the child...
     if (!childPID) {
-        // If we need to read from the file, we replace STDIN by the given file
-        if (!direction)
-            dup2(fileDescriptor, STDIN_FILENO);
-        // If we need to write to the file, we replace STDOUT by the given file
-        else
-            dup2(fileDescriptor, STDOUT_FILENO);
-
-        // Close the file since it was already duplicated
-        close(fileDescriptor);
+        if (newGroup)
+            joinProcessGroup(0, 0, giveTerminal);
+        for (size_t i = 0; i < fileDescriptors.size(); i++) {
+            // If we need to read from the file, we replace STDIN by the given file
+            if (!directions[i])
+                dup2(fileDescriptors[i], STDIN_FILENO);
+            // If we need to write to the file, we replace STDOUT by the given file
+            else
+                dup2(fileDescriptors[i], STDOUT_FILENO);
+
+            // Close the file since it was already duplicated
+            close(fileDescriptors[i]);
+        }
 
         // Execute the command, and exit with its status
         exit(this->command->execute(environPtr, false));
     }
     
-    // Back to the parent, we close the file, so the child doesn't hang, if its reading
-    close(fileDescriptor);
+    // Back to the parent, we close the files, so the child doesn't hang, if its reading
+    for (int fileDescriptor : fileDescriptors)
+        close(fileDescriptor);
     int status = 0;
+    bool inTime = true;
     // Only wait if we have forked, if we didn't, another process is waiting, so keep it moving
-    if (shouldFork)
-        waitpid(childPID, &status, 0);
+    if (shouldFork) {
+        if (newGroup)
+            joinProcessGroup(childPID, 0, giveTerminal);
+        uint64_t waitStart = latencyStats::now();
+        inTime = childSupervisor::waitForChild(childPID, status);
+        uint64_t reapTime = latencyStats::now();
+        if (giveTerminal)
+            reclaimTerminal();
+
+        std::string childName = this->executableName();
+        if (!childName.empty())
+            latencyStats::recordChild(childName, childPID, forkTime, waitStart, reapTime);
+    }
 
-    // Return the exit status if it was successful
+    // 124 if the default timeout cut it short, the exit status if it was successful
+    if (!inTime)
+        return 124;
     if (WIFEXITED(status))
         return WEXITSTATUS(status);
     else
         return -1;
 }
 
+/*
+ * redirectCommand optimize function
+ * "cmd < in > out" is parsed as a redirect around a redirect, the two are folded into one node that opens both files
+ * The outer redirections used to be applied first, so the inner ones are appended after them, whichever came last still wins
+ */
+std::unique_ptr<Command> redirectCommand::optimize() {
+    optimizeTree(this->command);
+
+    redirectCommand *innerRedirect = dynamic_cast<redirectCommand *>(this->command.get());
+    if (innerRedirect) {
+        this->redirections.insert(this->redirections.end(), innerRedirect->redirections.begin(), innerRedirect->redirections.end());
+        std::unique_ptr<Command> innerCommand = std::move(innerRedirect->command);
+        this->command = std::move(innerCommand);
+    }
+    return nullptr;
+}
+
+void redirectCommand::explain(std::ostream &output, int depth) const {
+    output << std::string(4 * depth, ' ') << "redirect:";
+    for (const auto &redirect : this->redirections) {
+        const char *symbol = (redirect.type == "read" || redirect.type == "cat") ? "<" : (redirect.type == "append") ? ">>" : ">";
+        output << " " << symbol << " " << redirect.fileName;
+    }
+    output << std::endl;
+    explainTree(this->command, output, depth + 1);
+}
+
+std::string redirectCommand::executableName() const {
+    return this->command ? this->command->executableName() : "";
+}
+
 /*------------------orCommand Class--------------------*/
 
 orCommand::orCommand(std::unique_ptr<Command> leftCommand, std::unique_ptr<Command> rightCommand) : 
@@ -342,6 +716,9 @@ orCommand::orCommand(std::unique_ptr<Command> leftCommand, std::unique_ptr<Comma
 }
 
 int orCommand::execute(char **environ, bool shouldFork) {
+    static latencyHistogram &nodeLatency = latencyStats::node("or");
+    latencyScope scope(nodeLatency);
+
     int status = this->leftChild->execute(environ, true);
 
     if (status)
@@ -351,6 +728,26 @@ int orCommand::execute(char **environ, bool shouldFork) {
 }
 
 
+/*
+ * orCommand optimize function
+ * The mirror image of the AND rules: "false || x" is just x, and "true || x" is just true
+ */
+std::unique_ptr<Command> orCommand::optimize() {
+    optimizeTree(this->leftChild);
+    optimizeTree(this->rightChild);
+
+    constantCommand *constantLeft = dynamic_cast<constantCommand *>(this->leftChild.get());
+    if (!constantLeft || !this->rightChild)
+        return nullptr;
+    return constantLeft->getStatus() ? std::move(this->rightChild) : std::move(this->leftChild);
+}
+
+void orCommand::explain(std::ostream &output, int depth) const {
+    output << std::string(4 * depth, ' ') << "or" << std::endl;
+    explainTree(this->leftChild, output, depth + 1);
+    explainTree(this->rightChild, output, depth + 1);
+}
+
 /*------------------sequenceCommand Class--------------------*/
 
 sequenceCommand::sequenceCommand(std::unique_ptr<Command> leftCommand, std::unique_ptr<Command> rightCommand) :
@@ -359,7 +756,166 @@ sequenceCommand::sequenceCommand(std::unique_ptr<Command> leftCommand, std::uniq
 }
 
 int sequenceCommand::execute(char **environPtr, bool shouldFork) {
+    static latencyHistogram &nodeLatency = latencyStats::node("sequence");
+    latencyScope scope(nodeLatency);
+
     this->leftChild->execute(environPtr, true);
 
     return this->rightChild->execute(environPtr, true);
 }
+
+
+/*
+ * sequenceCommand optimize function
+ * A constant on the left does nothing and its status is thrown away, "true ; x" is just x
+ */
+std::unique_ptr<Command> sequenceCommand::optimize() {
+    optimizeTree(this->leftChild);
+    optimizeTree(this->rightChild);
+
+    if (!dynamic_cast<constantCommand *>(this->leftChild.get()) || !this->rightChild)
+        return nullptr;
+    return std::move(this->rightChild);
+}
+
+void sequenceCommand::explain(std::ostream &output, int depth) const {
+    output << std::string(4 * depth, ' ') << "sequence" << std::endl;
+    explainTree(this->leftChild, output, depth + 1);
+    explainTree(this->rightChild, output, depth + 1);
+}
+
+/*------------------withCommand Class--------------------*/
+
+withCommand::withCommand(std::unique_ptr<Command> givenCommand, const std::vector<std::string> &options) :
+    command(std::move(givenCommand)), optionList(options) {
+    this->validLimits = this->limits.parse(options);
+}
+
+/*
+ * withCommand execute function
+ * It never forks on its own, it only makes its settings the active ones while the wrapped command runs
+ * That way every child the wrapped command forks (one for a simple command, one per stage for a pipe) picks them up in forkProcess()
+ */
+int withCommand::execute(char **environPtr, bool shouldFork) {
+    static latencyHistogram &nodeLatency = latencyStats::node("with");
+    latencyScope scope(nodeLatency);
+
+    if (!this->validLimits)
+        return 1;
+
+    // If shouldFork is false, we already are the forked child, so the settings are applied to this very process
+    if (!shouldFork) {
+        if (!this->limits.apply())
+            return 1;
+        return this->command->execute(environPtr, false);
+    }
+
+    // Nested "with" commands stack, the inner settings are layered on top of the outer ones
+    executionLimits combinedLimits;
+    if (activeLimits)
+        combinedLimits = *activeLimits;
+    combinedLimits.merge(this->limits);
+
+    const executionLimits *previousLimits = activeLimits;
+    activeLimits = &combinedLimits;
+    int status = this->command->execute(environPtr, true);
+    activeLimits = previousLimits;
+
+    return status;
+}
+
+std::unique_ptr<Command> withCommand::optimize() {
+    optimizeTree(this->command);
+    return nullptr;
+}
+
+void withCommand::explain(std::ostream &output, int depth) const {
+    output << std::string(4 * depth, ' ') << "with:";
+    for (const auto &option : this->optionList)
+        output << " " << option;
+    output << std::endl;
+    explainTree(this->command, output, depth + 1);
+}
+
+std::string withCommand::executableName() const {
+    return this->command ? this->command->executableName() : "";
+}
+
+/*------------------timeoutCommand Class--------------------*/
+
+timeoutCommand::timeoutCommand(std::unique_ptr<Command> givenCommand, const std::string &duration) :
+    command(std::move(givenCommand)), timeout(0) {
+    this->validTimeout = childSupervisor::parseDuration(duration, this->timeout);
+    if (!this->validTimeout)
+        std::cerr << "timeout: invalid duration \"" << duration << "\"" << std::endl;
+}
+
+/*
+ * timeoutCommand execute function
+ * The command always runs in a child of its own, leading a new process group, so that everything it starts can be killed at once
+ * This process stays behind as the supervisor, even when shouldFork is false, someone has to watch the clock
+ */
+int timeoutCommand::execute(char **environPtr, bool shouldFork) {
+    static latencyHistogram &nodeLatency = latencyStats::node("timeout");
+    latencyScope scope(nodeLatency);
+
+    if (!this->validTimeout)
+        return 1;
+
+    // If we own the terminal, the new process group has to be given the foreground, or reading from the terminal would stop it
+    bool giveTerminal = ownsTerminal();
+
+    pid_t childPID = this->forkProcess();
+    if (childPID == -1) {
+        perror("Failed to fork");
+        return -1;
+    }
+
+    // The group and the terminal are set up on both sides, whichever runs first wins the race and the other is a no-op
+    if (!childPID) {
+        joinProcessGroup(0, 0, giveTerminal);
+        exit(this->command->execute(environPtr, false));
+    }
+    joinProcessGroup(childPID, 0, giveTerminal);
+
+    int status;
+    bool inTime = childSupervisor::waitForChild(childPID, status, this->timeout);
+
+    // Take the terminal back, we are the background group now
+    if (giveTerminal)
+        reclaimTerminal();
+
+    // Like coreutils' timeout, 124 tells that the command was cut short
+    if (!inTime)
+        return 124;
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    return -1;
+}
+
+std::unique_ptr<Command> timeoutCommand::optimize() {
+    optimizeTree(this->command);
+    return nullptr;
+}
+
+void timeoutCommand::explain(std::ostream &output, int depth) const {
+    output << std::string(4 * depth, ' ') << "timeout: " << this->timeout << "ms" << std::endl;
+    explainTree(this->command, output, depth + 1);
+}
+
+/*------------------constantCommand Class--------------------*/
+
+constantCommand::constantCommand(int givenStatus) : status(givenStatus) {
+
+}
+
+int constantCommand::execute(char **environPtr, bool shouldFork) {
+    static latencyHistogram &nodeLatency = latencyStats::node("constant");
+    latencyScope scope(nodeLatency);
+
+    return this->status;
+}
+
+void constantCommand::explain(std::ostream &output, int depth) const {
+    output << std::string(4 * depth, ' ') << "constant: " << this->status << std::endl;
+}
@@ -9,6 +9,17 @@
 #include <memory>
 #include <sstream>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#include <algorithm>
+#include "arithmetic.hpp"
+#include "limits.hpp"
+#include "supervisor.hpp"
+#include "stats.hpp"
+#include "builtins.hpp"
 
 /*
  * Abstract Command class, the contract that each type of command should adhere to
@@ -22,10 +33,45 @@ class Command{
         // The start of a great inheritence chain, by making this function virtual, we force all the children to implement their own version
         // Which gives us the opportunity to implement different types of commands, e.g. simple commands, logically connected commands...
         virtual int execute(char **environPtr, bool shouldFork = true) = 0;
+
+        // The optimizer pass, runs between parsing and execute(), returns a cheaper command that does the same thing,
+        // or nullptr to keep this one, the children are optimized (and replaced) first, so a rewrite only ever looks one level down
+        virtual std::unique_ptr<Command> optimize() { return nullptr; }
+
+        // Prints the tree under this command, one node per line indented by its depth, for "kamish --explain"
+        virtual void explain(std::ostream &output, int depth) const = 0;
+
+        // The program a child forked for this command ends up exec'ing, the name its latencies are recorded under,
+        // empty when that's not a single program (a built-in, a pipe, a sequence...)
+        virtual std::string executableName() const { return ""; }
+
+        // Optimizes a whole tree in place, command may be replaced by a different node
+        static void optimizeTree(std::unique_ptr<Command> &command);
+        static void explainTree(const std::unique_ptr<Command> &command, std::ostream &output, int depth);
     
     // Give all types of commands to resolve the absolute path of a given executable
     protected:
         std::string getAbsolutePath(const std::string &executableName);
+
+        // The settings of the innermost "with" being executed, every child forked while it runs applies them before going on
+        static const executionLimits *activeLimits;
+
+        // fork() for every type of command, the child comes back with the active "with" settings already applied
+        pid_t forkProcess();
+
+        // The shell's own pid, forked children compare it with getpid() to know they are not the shell
+        static const pid_t shellPID;
+
+        // True when the children forked now must lead a process group of their own, only the shell itself does it,
+        // and only with a default timeout, so that a timed out job goes down with everything it started
+        static bool startsJobGroups();
+        // Puts pid (0 for the calling process) in the group led by leader (0 to lead its own), and gives that group the terminal if asked
+        // Called on both sides of the fork(), whichever runs first wins the race and the other is a no-op
+        static void joinProcessGroup(pid_t pid, pid_t leader, bool giveTerminal);
+        // True when the shell's process group is the foreground one of the terminal on STDIN
+        static bool ownsTerminal();
+        // Makes the shell's process group the foreground one again, once the job is done
+        static void reclaimTerminal();
 };
 
 /*
@@ -36,13 +82,29 @@ class simpleCommand : public Command {
     // This way we don't need to pass the arguments to the execute function, it can access them directly
     private:
         std::vector<std::string> argumentList;
+        // The single quoted ranges of each argument, the expansion stage skips them
+        std::vector<arithmeticExpression::literalRanges> literalList;
 
     // Adhere to the abstract class: Construct the command from its tokenized arguments
     // Define the custom execute function, again, adhering to the contract
     public:
-        simpleCommand(const std::vector<std::string> &arguments);
+        simpleCommand(const std::vector<std::string> &arguments,
+                const std::vector<arithmeticExpression::literalRanges> &literals = std::vector<arithmeticExpression::literalRanges>());
         int execute(char **environPtr, bool shouldFork) override;
-        
+
+        // Fills arguments with the argument list after expansion, returns false if an expansion failed
+        bool expandArguments(std::vector<std::string> &arguments) const;
+        // True for the built-ins a pipeline can run on a thread instead of forking a child for them
+        bool runsOnThread() const;
+        // True for the built-ins that read their input, see builtinCommands::readsInput()
+        bool readsInput() const;
+        // True for a plain "cat FILE", the optimizer turns "cat FILE | cmd" into "cmd < FILE"
+        bool catsSingleFile(std::string &fileName) const;
+
+        std::unique_ptr<Command> optimize() override;
+        void explain(std::ostream &output, int depth) const override;
+        std::string executableName() const override;
+
 };
 
 /*
@@ -60,10 +122,14 @@ class andCommand : public Command {
     public:
         andCommand(std::unique_ptr<Command> leftCommand, std::unique_ptr<Command> rightCommand);
         int execute(char **environPtr, bool shouldFork) override;
+        std::unique_ptr<Command> optimize() override;
+        void explain(std::ostream &output, int depth) const override;
 };
 
 /*
  * pipeCommand - for commands connected with a pipe '|'
+ * "a | b | c" is parsed as pipe(a, pipe(b, c)), the outermost node runs the whole chain at once:
+ * external stages are forked, built-in stages like echo or read run on threads of the shell, straight on the pipe ends
  */
 
 class pipeCommand : public Command {
@@ -78,6 +144,8 @@ class pipeCommand : public Command {
     public:
         pipeCommand(std::unique_ptr<Command> leftCommand, std::unique_ptr<Command> rightCommand);
         int execute(char **environPtr, bool shouldFork) override;
+        std::unique_ptr<Command> optimize() override;
+        void explain(std::ostream &output, int depth) const override;
 };
 
 /*
@@ -85,13 +153,22 @@ class pipeCommand : public Command {
  */
 class redirectCommand : public Command {
     private:
+        // One file and how it's opened, "trunc", "append", "read", or "cat", a "read" that fails the way "cat FILE" would
+        struct redirection {
+            std::string fileName;
+            std::string type;
+        };
+
         std::unique_ptr<Command> command;
-        std::string fileName;
-        std::string type;
+        // The parser gives each node one redirection, the optimizer folds stacked nodes into one, applied in order
+        std::vector<redirection> redirections;
 
     public:
         redirectCommand(std::unique_ptr<Command> givenCommand, const std::string &givenFileName, const std::string &redirectType);
         int execute(char **environPtr, bool shouldFork) override;
+        std::unique_ptr<Command> optimize() override;
+        void explain(std::ostream &output, int depth) const override;
+        std::string executableName() const override;
 };
 
 /*
@@ -105,6 +182,8 @@ class sequenceCommand : public Command {
     public:
         sequenceCommand(std::unique_ptr<Command> leftCommand, std::unique_ptr<Command> rightCommand);
         int execute(char **environPtr, bool shouldFork) override;
+        std::unique_ptr<Command> optimize() override;
+        void explain(std::ostream &output, int depth) const override;
 };
 
 /*
@@ -118,6 +197,59 @@ class orCommand : public Command {
     public:
         orCommand(std::unique_ptr<Command> leftCommand, std::unique_ptr<Command> rightCommand);
         int execute(char **environPtr, bool shouldFork) override;
+        std::unique_ptr<Command> optimize() override;
+        void explain(std::ostream &output, int depth) const override;
+};
+
+/*
+ * withCommand - runs a command under the scheduling and resource settings of the "with" built-in
+ * e.g. "with cpu=0-3 nice=10 io=idle mem=2G -- cmd"
+ */
+class withCommand : public Command {
+    private:
+        std::unique_ptr<Command> command;
+        executionLimits limits;
+        bool validLimits;
+        // The options as they were written, for --explain
+        std::vector<std::string> optionList;
+
+    public:
+        withCommand(std::unique_ptr<Command> givenCommand, const std::vector<std::string> &options);
+        int execute(char **environPtr, bool shouldFork) override;
+        std::unique_ptr<Command> optimize() override;
+        void explain(std::ostream &output, int depth) const override;
+        std::string executableName() const override;
+};
+
+/*
+ * timeoutCommand - runs a command with a deadline, e.g. "timeout 30s cmd"
+ * On expiry the whole process group of the command gets SIGTERM, then SIGKILL if it's still there after a grace period
+ */
+class timeoutCommand : public Command {
+    private:
+        std::unique_ptr<Command> command;
+        long long timeout;
+        bool validTimeout;
+
+    public:
+        timeoutCommand(std::unique_ptr<Command> givenCommand, const std::string &duration);
+        int execute(char **environPtr, bool shouldFork) override;
+        std::unique_ptr<Command> optimize() override;
+        void explain(std::ostream &output, int depth) const override;
+};
+
+/*
+ * constantCommand - what the optimizer turns "true", "false" and ":" into, it just returns its status, no fork, no execve()
+ */
+class constantCommand : public Command {
+    private:
+        int status;
+
+    public:
+        constantCommand(int givenStatus);
+        int execute(char **environPtr, bool shouldFork) override;
+        void explain(std::ostream &output, int depth) const override;
+        int getStatus() const { return this->status; }
 };
 
 #endif
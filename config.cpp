@@ -0,0 +1,240 @@
+#include "config.hpp"
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+// The snapshot starts with this header, the magic doubles as a version number, bump it whenever the layout changes
+// Each entry follows as [1 byte kind][4 bytes name length][4 bytes value length][name][value], in native byte order
+#define SNAPSHOT_MAGIC "KMSHRC01"
+#define ENTRY_HEADER_SIZE 9
+
+struct snapshotHeader {
+    char magic[8];
+    int64_t rcModifiedSeconds;
+    int64_t rcModifiedNanoseconds;
+    int64_t rcSize;
+    uint32_t entryCount;
+    uint32_t reserved;
+};
+
+enum snapshotEntryKind : char {
+    ENTRY_ALIAS = 'A',
+    ENTRY_FUNCTION = 'F',
+    ENTRY_VARIABLE = 'V'
+};
+
+/*
+ * stripQuotes - removes one pair of matching quotes around a value, "alias ll='ls -la'" stores "ls -la"
+ */
+static std::string stripQuotes(const std::string &value) {
+    if (value.length() >= 2 && (value[0] == '\'' || value[0] == '"') && value[value.length() - 1] == value[0])
+        return value.substr(1, value.length() - 2);
+    return value;
+}
+
+static std::string trim(const std::string &text) {
+    size_t firstCharPos = text.find_first_not_of(" \t");
+    if (firstCharPos == std::string::npos)
+        return "";
+    return text.substr(firstCharPos, text.find_last_not_of(" \t") - firstCharPos + 1);
+}
+
+void rcConfiguration::load(const std::string &rcPath, const std::string &snapshotPath) {
+    struct stat rcStatus;
+
+    // No rc file, nothing to do, this is the fastest path of all
+    if (stat(rcPath.c_str(), &rcStatus) == -1)
+        return;
+
+    if (!this->loadSnapshot(snapshotPath, rcStatus)) {
+        if (!this->parseFile(rcPath))
+            return;
+        this->saveSnapshot(snapshotPath, rcStatus);
+    }
+
+    for (const auto &variable : this->variables)
+        setenv(variable.first.c_str(), variable.second.c_str(), 1);
+}
+
+/*
+ * loadSnapshot - maps the snapshot and reads the entries straight out of the mapping
+ * Any mismatch (other rc mtime or size, truncated file, other layout) makes it return false, and the rc file is parsed instead
+ */
+bool rcConfiguration::loadSnapshot(const std::string &snapshotPath, const struct stat &rcStatus) {
+    int snapshotFd = open(snapshotPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (snapshotFd == -1)
+        return false;
+
+    struct stat snapshotStatus;
+    if (fstat(snapshotFd, &snapshotStatus) == -1 || snapshotStatus.st_size < static_cast<off_t>(sizeof(snapshotHeader))) {
+        close(snapshotFd);
+        return false;
+    }
+
+    size_t size = snapshotStatus.st_size;
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, snapshotFd, 0);
+    close(snapshotFd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    const char *data = static_cast<const char *>(mapping);
+    snapshotHeader header;
+    std::memcpy(&header, data, sizeof(header));
+
+    bool valid = !std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic))
+        && header.rcModifiedSeconds == static_cast<int64_t>(rcStatus.st_mtim.tv_sec)
+        && header.rcModifiedNanoseconds == static_cast<int64_t>(rcStatus.st_mtim.tv_nsec)
+        && header.rcSize == static_cast<int64_t>(rcStatus.st_size);
+
+    size_t offset = sizeof(header);
+    for (uint32_t i = 0; valid && i < header.entryCount; i++) {
+        uint32_t nameLength, valueLength;
+
+        if (size - offset < ENTRY_HEADER_SIZE) {
+            valid = false;
+            break;
+        }
+        char kind = data[offset];
+        std::memcpy(&nameLength, data + offset + 1, sizeof(nameLength));
+        std::memcpy(&valueLength, data + offset + 5, sizeof(valueLength));
+        offset += ENTRY_HEADER_SIZE;
+
+        if (size - offset < static_cast<size_t>(nameLength) + valueLength) {
+            valid = false;
+            break;
+        }
+        std::string name(data + offset, nameLength);
+        std::string value(data + offset + nameLength, valueLength);
+        offset += nameLength + valueLength;
+
+        if (kind == ENTRY_ALIAS)
+            this->aliases[name] = value;
+        else if (kind == ENTRY_FUNCTION)
+            this->functions[name] = value;
+        else if (kind == ENTRY_VARIABLE)
+            this->variables.push_back(std::make_pair(name, value));
+        else
+            valid = false;
+    }
+    munmap(mapping, size);
+
+    // Don't keep half of a broken snapshot around, the rc file is about to be parsed from scratch
+    if (!valid) {
+        this->aliases.clear();
+        this->functions.clear();
+        this->variables.clear();
+    }
+    return valid;
+}
+
+/*
+ * saveSnapshot - written to a temporary file first and renamed into place, so a concurrent start never maps half a snapshot
+ * Failing to save is not an error, the next start will just parse the rc file again
+ */
+void rcConfiguration::saveSnapshot(const std::string &snapshotPath, const struct stat &rcStatus) {
+    snapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.rcModifiedSeconds = rcStatus.st_mtim.tv_sec;
+    header.rcModifiedNanoseconds = rcStatus.st_mtim.tv_nsec;
+    header.rcSize = rcStatus.st_size;
+    header.entryCount = static_cast<uint32_t>(this->aliases.size() + this->functions.size() + this->variables.size());
+
+    std::string buffer(reinterpret_cast<const char *>(&header), sizeof(header));
+    auto appendEntry = [&buffer](char kind, const std::string &name, const std::string &value) {
+        uint32_t nameLength = static_cast<uint32_t>(name.length());
+        uint32_t valueLength = static_cast<uint32_t>(value.length());
+        buffer += kind;
+        buffer.append(reinterpret_cast<const char *>(&nameLength), sizeof(nameLength));
+        buffer.append(reinterpret_cast<const char *>(&valueLength), sizeof(valueLength));
+        buffer += name;
+        buffer += value;
+    };
+
+    for (const auto &alias : this->aliases)
+        appendEntry(ENTRY_ALIAS, alias.first, alias.second);
+    for (const auto &function : this->functions)
+        appendEntry(ENTRY_FUNCTION, function.first, function.second);
+    for (const auto &variable : this->variables)
+        appendEntry(ENTRY_VARIABLE, variable.first, variable.second);
+
+    std::string temporaryPath = snapshotPath + "." + std::to_string(getpid());
+    int snapshotFd = open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (snapshotFd == -1)
+        return;
+
+    bool written = write(snapshotFd, buffer.data(), buffer.length()) == static_cast<ssize_t>(buffer.length());
+    close(snapshotFd);
+    if (!written || rename(temporaryPath.c_str(), snapshotPath.c_str()) == -1)
+        unlink(temporaryPath.c_str());
+}
+
+bool rcConfiguration::parseFile(const std::string &rcPath) {
+    std::ifstream rcFile(rcPath);
+    std::string line;
+    int lineNumber = 0;
+
+    if (!rcFile)
+        return false;
+
+    while (std::getline(rcFile, line)) {
+        lineNumber++;
+        if (!this->parseLine(trim(line)))
+            std::cerr << "kamish: " << rcPath << ":" << lineNumber << ": unsupported line, only alias, export and functions are allowed" << std::endl;
+    }
+    return true;
+}
+
+/*
+ * parseLine - one line of the rc file, returns false if it's none of the supported forms
+ */
+bool rcConfiguration::parseLine(const std::string &line) {
+    // Blank lines and comments
+    if (line.empty() || line[0] == '#')
+        return true;
+
+    // alias NAME=VALUE and export NAME=VALUE
+    bool isAlias = !line.compare(0, 6, "alias ");
+    if (isAlias || !line.compare(0, 7, "export ")) {
+        std::string definition = trim(line.substr(isAlias ? 6 : 7));
+        size_t equalPos = definition.find('=');
+        if (equalPos == std::string::npos || !equalPos)
+            return false;
+
+        std::string name = definition.substr(0, equalPos);
+        std::string value = stripQuotes(definition.substr(equalPos + 1));
+        if (isAlias)
+            this->aliases[name] = value;
+        else
+            this->variables.push_back(std::make_pair(name, value));
+        return true;
+    }
+
+    // NAME() { BODY }, on a single line
+    size_t parensPos = line.find("()");
+    if (parensPos == std::string::npos)
+        return false;
+
+    std::string name = trim(line.substr(0, parensPos));
+    std::string body = trim(line.substr(parensPos + 2));
+    if (name.empty() || name.find_first_of(" \t") != std::string::npos || body.length() < 2 || body[0] != '{' || body[body.length() - 1] != '}')
+        return false;
+
+    this->functions[name] = trim(body.substr(1, body.length() - 2));
+    return true;
+}
+
+const std::string *rcConfiguration::findAlias(const std::string &name) const {
+    auto alias = this->aliases.find(name);
+    return (alias == this->aliases.end()) ? nullptr : &alias->second;
+}
+
+const std::string *rcConfiguration::findFunction(const std::string &name) const {
+    auto function = this->functions.find(name);
+    return (function == this->functions.end()) ? nullptr : &function->second;
+}
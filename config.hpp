@@ -0,0 +1,39 @@
+#ifndef __CONFIG__
+#define __CONFIG__
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <sys/stat.h>
+
+/*
+ * rcConfiguration - the aliases, functions and environment defined in ~/.kamishrc
+ * The rc file understands three kinds of lines (plus comments):
+ *     alias ll='ls -la'
+ *     export EDITOR=vim
+ *     mkcd() { mkdir $1 && cd $1 }
+ * Parsing it on every start would be a waste, so the parsed result is saved to a compact binary snapshot,
+ * the next start maps the snapshot instead, as long as the rc file's mtime and size still match the ones recorded in it
+ */
+class rcConfiguration {
+    private:
+        std::unordered_map<std::string, std::string> aliases;
+        std::unordered_map<std::string, std::string> functions;
+        std::vector<std::pair<std::string, std::string>> variables;
+
+        bool loadSnapshot(const std::string &snapshotPath, const struct stat &rcStatus);
+        void saveSnapshot(const std::string &snapshotPath, const struct stat &rcStatus);
+        bool parseFile(const std::string &rcPath);
+        bool parseLine(const std::string &line);
+
+    public:
+        // Loads the rc file, through its snapshot when it's fresh, and exports its variables to the environment
+        void load(const std::string &rcPath, const std::string &snapshotPath);
+
+        // Return nullptr if there is no alias (or function) by that name
+        const std::string *findAlias(const std::string &name) const;
+        const std::string *findFunction(const std::string &name) const;
+};
+
+#endif
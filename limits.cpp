@@ -0,0 +1,235 @@
+#include "limits.hpp"
+#include <cstdlib>
+#include <cctype>
+#include <sstream>
+#include <cstdio>
+#include <cerrno>
+#include <limits>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// ioprio_set() has no glibc wrapper, these mirror the kernel's linux/ioprio.h
+#define IOPRIO_WHO_PROCESS  1
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_CLASS_RT     1
+#define IOPRIO_CLASS_BE     2
+#define IOPRIO_CLASS_IDLE   3
+
+executionLimits::executionLimits() : hasAffinity(false), hasNice(false), niceValue(0), hasIoPriority(false), ioClass(0), ioLevel(0) {
+    CPU_ZERO(&this->affinity);
+}
+
+/*
+ * parseCpuList - parses a taskset style list of cpus, e.g. "0-3,6,8-9"
+ */
+bool executionLimits::parseCpuList(const std::string &list) {
+    std::string range;
+    std::stringstream streamedList(list);
+
+    CPU_ZERO(&this->affinity);
+    while (std::getline(streamedList, range, ',')) {
+        char *end;
+        long first = std::strtol(range.c_str(), &end, 10);
+        long last = first;
+
+        if (end == range.c_str())
+            return false;
+        if (*end == '-') {
+            const char *lastStart = end + 1;
+            last = std::strtol(lastStart, &end, 10);
+            if (end == lastStart)
+                return false;
+        }
+        if (*end || first < 0 || last < first || last >= CPU_SETSIZE)
+            return false;
+
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, &this->affinity);
+    }
+    return CPU_COUNT(&this->affinity) > 0;
+}
+
+/*
+ * parseIoPriority - "idle", "be", "be:N", "rt:N", or just "N" which is shorthand for "be:N"
+ */
+bool executionLimits::parseIoPriority(const std::string &value) {
+    std::string className = value;
+    std::string level = "4";
+    size_t colonPos = value.find(':');
+
+    if (colonPos != std::string::npos) {
+        className = value.substr(0, colonPos);
+        level = value.substr(colonPos + 1);
+    }
+    else if (!value.empty() && std::isdigit(static_cast<unsigned char>(value[0]))) {
+        className = "be";
+        level = value;
+    }
+
+    if (className == "idle" && colonPos == std::string::npos) {
+        this->ioClass = IOPRIO_CLASS_IDLE;
+        this->ioLevel = 0;
+        return true;
+    }
+    if (className == "be")
+        this->ioClass = IOPRIO_CLASS_BE;
+    else if (className == "rt")
+        this->ioClass = IOPRIO_CLASS_RT;
+    else
+        return false;
+
+    // The best-effort and realtime classes both have eight levels, 0 being the highest priority
+    char *end;
+    long ioLevel = std::strtol(level.c_str(), &end, 10);
+    if (level.empty() || *end || ioLevel < 0 || ioLevel > 7)
+        return false;
+    this->ioLevel = static_cast<int>(ioLevel);
+    return true;
+}
+
+/*
+ * parseSize - a byte count with an optional K, M, G or T suffix (powers of 1024), or "unlimited"
+ * Anything that doesn't fit, before or after the suffix is applied, is refused rather than wrapped around,
+ * and so is a count that would land on RLIM_INFINITY, "unlimited" is the only way to ask for that
+ */
+bool executionLimits::parseSize(const std::string &value, rlim_t &size) {
+    if (value == "unlimited") {
+        size = RLIM_INFINITY;
+        return true;
+    }
+
+    // strtoull() happily negates "-1" into a huge count, only digits are a size
+    if (value.empty() || !std::isdigit(static_cast<unsigned char>(value[0])))
+        return false;
+
+    char *end;
+    errno = 0;
+    unsigned long long number = std::strtoull(value.c_str(), &end, 10);
+    if (errno == ERANGE)
+        return false;
+
+    int shift = 0;
+    switch (*end) {
+        case 'T': case 't': shift = 40; end++; break;
+        case 'G': case 'g': shift = 30; end++; break;
+        case 'M': case 'm': shift = 20; end++; break;
+        case 'K': case 'k': shift = 10; end++; break;
+        case '\0': break;
+        default: return false;
+    }
+    if (*end || number > (std::numeric_limits<rlim_t>::max() >> shift))
+        return false;
+
+    number <<= shift;
+    if (static_cast<rlim_t>(number) == RLIM_INFINITY)
+        return false;
+    size = static_cast<rlim_t>(number);
+    return true;
+}
+
+bool executionLimits::parse(const std::vector<std::string> &options) {
+    for (const auto &option : options) {
+        size_t equalPos = option.find('=');
+        std::string key = option.substr(0, equalPos);
+        std::string value = (equalPos == std::string::npos) ? "" : option.substr(equalPos + 1);
+        bool valid = !value.empty();
+
+        if (!valid) {
+            // Nothing to parse, the error is reported below
+        }
+        else if (key == "cpu") {
+            this->hasAffinity = true;
+            valid = this->parseCpuList(value);
+        }
+        else if (key == "nice") {
+            // The range is checked on the long, narrowing first would let a huge value wrap around into the range
+            char *end;
+            errno = 0;
+            long niceValue = std::strtol(value.c_str(), &end, 10);
+            this->hasNice = true;
+            valid = !*end && errno != ERANGE && niceValue >= -20 && niceValue <= 19;
+            if (valid)
+                this->niceValue = static_cast<int>(niceValue);
+        }
+        else if (key == "io") {
+            this->hasIoPriority = true;
+            valid = this->parseIoPriority(value);
+        }
+        else if (key == "mem") {
+            // mem caps the address space of the command
+            rlim_t size;
+            valid = this->parseSize(value, size);
+            if (valid)
+                this->resourceLimits.push_back(std::make_pair(RLIMIT_AS, size));
+        }
+        else if (key == "files" || key == "cputime") {
+            // files caps the number of open descriptors, cputime the seconds of cpu time, both are plain counts
+            rlim_t count;
+            valid = (value == "unlimited" || value.find_first_not_of("0123456789") == std::string::npos) && this->parseSize(value, count);
+            if (valid)
+                this->resourceLimits.push_back(std::make_pair(key == "files" ? RLIMIT_NOFILE : RLIMIT_CPU, count));
+        }
+        else {
+            valid = false;
+        }
+
+        if (!valid) {
+            std::cerr << "with: invalid option \"" << option << "\"" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void executionLimits::merge(const executionLimits &inner) {
+    if (inner.hasAffinity) {
+        this->hasAffinity = true;
+        this->affinity = inner.affinity;
+    }
+    if (inner.hasNice) {
+        this->hasNice = true;
+        this->niceValue = inner.niceValue;
+    }
+    if (inner.hasIoPriority) {
+        this->hasIoPriority = true;
+        this->ioClass = inner.ioClass;
+        this->ioLevel = inner.ioLevel;
+    }
+    // Limits are applied in order, so appending the inner ones makes them override the outer ones
+    this->resourceLimits.insert(this->resourceLimits.end(), inner.resourceLimits.begin(), inner.resourceLimits.end());
+}
+
+/*
+ * apply - everything here is inherited across fork() and execve(), that's what makes doing it in the child enough
+ * It stops at the first failure, a command should never run with half of what it asked for
+ */
+bool executionLimits::apply() const {
+    if (this->hasAffinity && sched_setaffinity(0, sizeof(this->affinity), &this->affinity) == -1) {
+        perror("with: sched_setaffinity failed");
+        return false;
+    }
+
+    if (this->hasNice && setpriority(PRIO_PROCESS, 0, this->niceValue) == -1) {
+        perror("with: setpriority failed");
+        return false;
+    }
+
+    if (this->hasIoPriority) {
+        int ioPriority = (this->ioClass << IOPRIO_CLASS_SHIFT) | this->ioLevel;
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioPriority) == -1) {
+            perror("with: ioprio_set failed");
+            return false;
+        }
+    }
+
+    for (const auto &limit : this->resourceLimits) {
+        struct rlimit newLimit;
+        newLimit.rlim_cur = limit.second;
+        newLimit.rlim_max = limit.second;
+        if (setrlimit(limit.first, &newLimit) == -1) {
+            perror("with: setrlimit failed");
+            return false;
+        }
+    }
+    return true;
+}
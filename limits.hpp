@@ -0,0 +1,48 @@
+#ifndef __LIMITS__
+#define __LIMITS__
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sched.h>
+#include <sys/resource.h>
+
+/*
+ * executionLimits - the scheduling and resource settings given to the "with" built-in
+ * e.g. "with cpu=0-3 nice=10 io=idle mem=2G -- cmd"
+ * They are parsed once, and applied in the forked child right before execve(), so no taskset/nice/ionice process is ever needed
+ */
+class executionLimits {
+    private:
+        // Every setting is optional, the "has" flags tell which ones were given
+        bool hasAffinity;
+        cpu_set_t affinity;
+
+        bool hasNice;
+        int niceValue;
+
+        bool hasIoPriority;
+        int ioClass;
+        int ioLevel;
+
+        // The resource limits, as (resource, value) pairs handed straight to setrlimit()
+        std::vector<std::pair<int, rlim_t>> resourceLimits;
+
+        bool parseCpuList(const std::string &list);
+        bool parseIoPriority(const std::string &value);
+        bool parseSize(const std::string &value, rlim_t &size);
+
+    public:
+        executionLimits();
+
+        // Parses "key=value" options, prints the offending option and returns false if one of them is invalid
+        bool parse(const std::vector<std::string> &options);
+
+        // Layers the given (inner) settings on top of these ones, the inner settings win
+        void merge(const executionLimits &inner);
+
+        // Applies the settings to the calling process, meant to be called in a freshly forked child
+        bool apply() const;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include "shell.hpp"
+#include "server.hpp"
+#include <fstream>
+
+/*
+ * The entry point, picks the mode the shell runs in:
+ * kamish [OPTIONS]                                                   the interactive shell, or a line by line loop if stdin is not a terminal
+ * kamish [OPTIONS] -c COMMAND                                        runs a single command line
+ * kamish [OPTIONS] SCRIPT                                            runs every line of the script
+ * kamish --serve PATH                                                runs command lines sent over the Unix socket at PATH
+ * kamish --connect PATH [-e NAME=VALUE]... [--repeat N] command...   sends a command line to a server and relays its output
+ * OPTIONS are any of:
+ *     --norc          don't load ~/.kamishrc
+ *     --no-optimize   execute the command trees exactly as parsed
+ *     --explain       print each line's plan, before and after the optimizer, instead of executing it
+ */
+int main(int argc, char **argv, char **envp) {
+    Shell shell(envp);
+    int argumentIndex = 1;
+
+    // The client never runs anything itself, it's the only mode that skips the rc file on its own
+    bool loadRc = !(argc > 1 && std::string(argv[1]) == "--connect");
+
+    // The shell options come first, in any order
+    for (; argumentIndex < argc; argumentIndex++) {
+        std::string option = argv[argumentIndex];
+        if (option == "--norc")
+            loadRc = false;
+        else if (option == "--no-optimize")
+            shell.setOptimize(false);
+        else if (option == "--explain")
+            shell.setExplain(true);
+        else
+            break;
+    }
+    if (loadRc)
+        shell.loadConfiguration();
+
+    std::string mode = (argc > argumentIndex) ? argv[argumentIndex] : "";
+
+    if (mode == "-c" && argc == argumentIndex + 2)
+        return shell.executeLine(argv[argumentIndex + 1], environ) & 0xff;
+
+    if (mode == "--serve" && argc == argumentIndex + 2) {
+        commandServer server(shell, argv[argumentIndex + 1]);
+        return server.serve() ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (mode == "--connect" && argumentIndex == 1 && argc > 3) {
+        std::vector<std::string> environment;
+        std::string commandLine;
+        int repeat = 1;
+        int i = 3;
+
+        // Options come first, everything after them is the command line
+        for (; i < argc; i++) {
+            std::string option = argv[i];
+            if (option == "-e" && i + 1 < argc)
+                environment.push_back(argv[++i]);
+            else if (option == "--repeat" && i + 1 < argc)
+                repeat = std::atoi(argv[++i]);
+            else
+                break;
+        }
+        for (; i < argc; i++)
+            commandLine += std::string(argv[i]) + (i + 1 < argc ? " " : "");
+
+        commandClient client(argv[2]);
+        int status = client.run(commandLine, environment, repeat > 0 ? repeat : 1);
+        return (status == -1) ? EXIT_FAILURE : status;
+    }
+
+    if (!mode.empty() && mode[0] != '-' && argc == argumentIndex + 1) {
+        std::ifstream script(mode);
+        if (!script) {
+            perror(("kamish: " + mode).c_str());
+            return 127;
+        }
+        return shell.runStream(script) & 0xff;
+    }
+
+    if (argc > argumentIndex) {
+        std::cerr << "usage: kamish [--norc] [--no-optimize] [--explain] [-c COMMAND | SCRIPT] | --serve PATH | --connect PATH [-e NAME=VALUE]... [--repeat N] command..." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return shell.run() & 0xff;
+}
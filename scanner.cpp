@@ -0,0 +1,172 @@
+#include "scanner.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCANNER_X86
+#endif
+
+unsigned char characterScanner::classTable[256];
+
+// One scanning routine per level, all with the same contract as findFirstOf(), negate turns it into findFirstNotOf()
+typedef size_t (*scanFunction)(const char *data, size_t length, size_t from, unsigned classes, bool negate);
+
+/*
+ * scanScalar - one table lookup per character, the fallback, and the tail of the vector loops
+ */
+static size_t scanScalar(const char *data, size_t length, size_t from, unsigned classes, bool negate) {
+    for (size_t i = from; i < length; i++) {
+        if ((characterScanner::classOf(data[i]) & classes) ? !negate : negate)
+            return i;
+    }
+    return length;
+}
+
+#ifdef SCANNER_X86
+/*
+ * scanSse2 - 16 characters per step, every requested class is a handful of byte compares OR'ed into one mask,
+ * movemask turns it into a bit per character and the lowest set bit is the answer
+ * '\t' to '\r' is a range, checked as (c - '\t') < 5 unsigned, flipping the sign bit makes the signed compare do the unsigned one
+ */
+static size_t scanSse2(const char *data, size_t length, size_t from, unsigned classes, bool negate) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i controlBase = _mm_set1_epi8('\t');
+    const __m128i signBit = _mm_set1_epi8(static_cast<char>(0x80));
+    const __m128i controlLimit = _mm_set1_epi8(static_cast<char>(0x80 + 5));
+    size_t i = from;
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i matches = _mm_setzero_si128();
+
+        if (classes & characterScanner::CLASS_SPACE) {
+            __m128i control = _mm_cmplt_epi8(_mm_xor_si128(_mm_sub_epi8(chunk, controlBase), signBit), controlLimit);
+            matches = _mm_or_si128(matches, _mm_or_si128(_mm_cmpeq_epi8(chunk, space), control));
+        }
+        if (classes & characterScanner::CLASS_QUOTE) {
+            matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('"')));
+            matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\'')));
+        }
+        if (classes & characterScanner::CLASS_OPERATOR) {
+            matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(';')));
+            matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('&')));
+            matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('|')));
+            matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('<')));
+            matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('>')));
+        }
+        if (classes & characterScanner::CLASS_DOLLAR)
+            matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('$')));
+        if (classes & characterScanner::CLASS_GROUP) {
+            matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('{')));
+            matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('}')));
+        }
+
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(matches));
+        if (negate)
+            mask = ~mask & 0xffff;
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return scanScalar(data, length, i, classes, negate);
+}
+
+/*
+ * scanAvx2 - the same, 32 characters per step, compiled for AVX2 on its own so the rest of the shell still runs on any x86-64
+ */
+__attribute__((target("avx2")))
+static size_t scanAvx2(const char *data, size_t length, size_t from, unsigned classes, bool negate) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i controlBase = _mm256_set1_epi8('\t');
+    const __m256i signBit = _mm256_set1_epi8(static_cast<char>(0x80));
+    const __m256i controlLimit = _mm256_set1_epi8(static_cast<char>(0x80 + 5));
+    size_t i = from;
+
+    for (; i + 32 <= length; i += 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        __m256i matches = _mm256_setzero_si256();
+
+        if (classes & characterScanner::CLASS_SPACE) {
+            __m256i control = _mm256_cmpgt_epi8(controlLimit, _mm256_xor_si256(_mm256_sub_epi8(chunk, controlBase), signBit));
+            matches = _mm256_or_si256(matches, _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space), control));
+        }
+        if (classes & characterScanner::CLASS_QUOTE) {
+            matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('"')));
+            matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\'')));
+        }
+        if (classes & characterScanner::CLASS_OPERATOR) {
+            matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(';')));
+            matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('&')));
+            matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('|')));
+            matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('<')));
+            matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('>')));
+        }
+        if (classes & characterScanner::CLASS_DOLLAR)
+            matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('$')));
+        if (classes & characterScanner::CLASS_GROUP) {
+            matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('{')));
+            matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('}')));
+        }
+
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(matches));
+        if (negate)
+            mask = ~mask;
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    // The tail is shorter than a full AVX2 step, but it may still be worth an SSE2 one
+    return scanSse2(data, length, i, classes, negate);
+}
+#endif
+
+static const char *activeLevel = "scalar";
+static scanFunction activeScan = scanScalar;
+
+bool characterScanner::initialized = characterScanner::initialize();
+
+bool characterScanner::initialize() {
+    for (const char *c = " \t\n\v\f\r"; *c; c++)
+        classTable[static_cast<unsigned char>(*c)] |= CLASS_SPACE;
+    for (const char *c = "\"'"; *c; c++)
+        classTable[static_cast<unsigned char>(*c)] |= CLASS_QUOTE;
+    for (const char *c = ";&|<>"; *c; c++)
+        classTable[static_cast<unsigned char>(*c)] |= CLASS_OPERATOR;
+    classTable[static_cast<unsigned char>('$')] |= CLASS_DOLLAR;
+    classTable[static_cast<unsigned char>('{')] |= CLASS_GROUP;
+    classTable[static_cast<unsigned char>('}')] |= CLASS_GROUP;
+
+#ifdef SCANNER_X86
+    // A forced level is only honored if the CPU has it, asking for avx2 on a machine without it gets sse2
+    const char *forcedLevel = getenv("KAMISH_SIMD");
+    bool allowAvx2 = !forcedLevel || !std::strcmp(forcedLevel, "avx2");
+    bool allowSse2 = allowAvx2 || !std::strcmp(forcedLevel, "sse2");
+
+    __builtin_cpu_init();
+    if (allowAvx2 && __builtin_cpu_supports("avx2")) {
+        activeLevel = "avx2";
+        activeScan = scanAvx2;
+    }
+    else if (allowSse2) {
+        activeLevel = "sse2";
+        activeScan = scanSse2;
+    }
+#endif
+    return true;
+}
+
+size_t characterScanner::findFirstOf(const std::string &text, size_t from, unsigned classes) {
+    if (from >= text.length())
+        return text.length();
+    return activeScan(text.data(), text.length(), from, classes, false);
+}
+
+size_t characterScanner::findFirstNotOf(const std::string &text, size_t from, unsigned classes) {
+    if (from >= text.length())
+        return text.length();
+    return activeScan(text.data(), text.length(), from, classes, true);
+}
+
+const char *characterScanner::level() {
+    return activeLevel;
+}
@@ -0,0 +1,43 @@
+#ifndef __SCANNER__
+#define __SCANNER__
+
+#include <iostream>
+#include <string>
+#include <cstddef>
+
+/*
+ * characterScanner - the character classification behind the lexer
+ * Instead of looking at a line one character at a time, the lexer asks for the next character of a given class,
+ * and the scanner answers 16 (SSE2) or 32 (AVX2) characters per step, everything in between is copied or skipped as one span
+ * The widest level the CPU supports is picked at startup, KAMISH_SIMD=scalar|sse2|avx2 forces a narrower one
+ */
+class characterScanner {
+    public:
+        enum characterClass : unsigned {
+            CLASS_SPACE = 1,        // ' ' and '\t' to '\r', what std::isspace() accepts
+            CLASS_QUOTE = 2,        // '"' and '\''
+            CLASS_OPERATOR = 4,     // ';', '&', '|', '<' and '>'
+            CLASS_DOLLAR = 8,       // '$'
+            CLASS_GROUP = 16        // '{' and '}'
+        };
+
+    private:
+        static unsigned char classTable[256];
+
+        // Fills the class table and picks the level, once, before main() runs
+        static bool initialized;
+        static bool initialize();
+
+    public:
+        static unsigned classOf(char c) { return classTable[static_cast<unsigned char>(c)]; }
+
+        // The position of the first character at or after from that belongs to one of the given classes, text.length() if there is none
+        static size_t findFirstOf(const std::string &text, size_t from, unsigned classes);
+        // The same, for the first character that belongs to none of them
+        static size_t findFirstNotOf(const std::string &text, size_t from, unsigned classes);
+
+        // The level in use, "scalar", "sse2" or "avx2"
+        static const char *level();
+};
+
+#endif
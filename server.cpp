@@ -0,0 +1,583 @@
+#include "server.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <climits>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+// Once this much output is waiting for a slow client, the server stops reading the command's pipes until the client catches up
+#define OUTPUT_HIGH_WATER 1048576
+#define FRAME_HEADER_SIZE 5
+// The largest request frame the server accepts, a command line, a directory or a variable, anything bigger drops the client
+#define MAX_FRAME_PAYLOAD 1048576
+// A well behaved client waits for the exit status before its next request, one frame and a read's worth of the next is all it ever has in flight
+#define MAX_INPUT_BACKLOG (2 * MAX_FRAME_PAYLOAD)
+
+/*----------------commandServer Class-------------------------------*/
+
+commandServer::commandServer(Shell &givenShell, const std::string &givenSocketPath)
+    : shell(givenShell), socketPath(givenSocketPath), listenFd(-1), epollFd(-1) {
+
+}
+
+commandServer::~commandServer() {
+    if (this->listenFd != -1) {
+        close(this->listenFd);
+        unlink(this->socketPath.c_str());
+    }
+    if (this->epollFd != -1)
+        close(this->epollFd);
+}
+
+/*
+ * watchFd / forgetFd - every descriptor enters and leaves the epoll set through these two, so fdOwners never goes stale
+ */
+void commandServer::watchFd(int fd, int owner, unsigned int events) {
+    struct epoll_event event;
+    event.events = events;
+    event.data.fd = fd;
+    epoll_ctl(this->epollFd, EPOLL_CTL_ADD, fd, &event);
+    this->fdOwners[fd] = owner;
+}
+
+void commandServer::forgetFd(int &fd) {
+    if (fd == -1)
+        return;
+    epoll_ctl(this->epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    this->fdOwners.erase(fd);
+    close(fd);
+    fd = -1;
+}
+
+int commandServer::serve() {
+    struct sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (this->socketPath.length() >= sizeof(address.sun_path)) {
+        std::cerr << "kamish: socket path is too long: " << this->socketPath << std::endl;
+        return -1;
+    }
+    std::strcpy(address.sun_path, this->socketPath.c_str());
+
+    this->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (this->listenFd == -1) {
+        perror("kamish: socket failed");
+        return -1;
+    }
+
+    // A socket file left behind by a previous server would make bind() fail
+    unlink(this->socketPath.c_str());
+    if (bind(this->listenFd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == -1 || listen(this->listenFd, SOMAXCONN) == -1) {
+        perror("kamish: cannot listen on the socket");
+        return -1;
+    }
+
+    this->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (this->epollFd == -1) {
+        perror("kamish: epoll_create1 failed");
+        return -1;
+    }
+    this->watchFd(this->listenFd, -1, EPOLLIN);
+
+    // The server's main loop, each descriptor is looked up to find its client and what it is to that client
+    while (true) {
+        struct epoll_event events[64];
+        int readyCount = epoll_wait(this->epollFd, events, 64, -1);
+
+        if (readyCount == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("kamish: epoll_wait failed");
+            return -1;
+        }
+
+        for (int i = 0; i < readyCount; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == this->listenFd) {
+                this->acceptClients();
+                continue;
+            }
+
+            // The descriptor may belong to a client that was dropped earlier in this same batch
+            auto owner = this->fdOwners.find(fd);
+            if (owner == this->fdOwners.end())
+                continue;
+            int socketFd = owner->second;
+            serverClient &client = this->clients[socketFd];
+
+            if (fd == client.socketFd) {
+                if (events[i].events & EPOLLOUT)
+                    this->flushOutput(client);
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    this->readRequest(client);
+            }
+            else if (fd == client.stdoutFd) {
+                this->readJobOutput(client, client.stdoutFd, FRAME_STDOUT);
+            }
+            else if (fd == client.stderrFd) {
+                this->readJobOutput(client, client.stderrFd, FRAME_STDERR);
+            }
+            else if (fd == client.pidFd) {
+                this->reapJob(client);
+            }
+
+            this->finishJobIfDone(client);
+            if (client.disconnected && client.jobPID == -1)
+                this->dropClient(socketFd);
+        }
+    }
+    return 0;
+}
+
+void commandServer::acceptClients() {
+    while (true) {
+        int socketFd = accept4(this->listenFd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (socketFd == -1)
+            return;
+
+        serverClient &client = this->clients[socketFd];
+        client.socketFd = socketFd;
+        client.jobPID = -1;
+        client.stdoutFd = -1;
+        client.stderrFd = -1;
+        client.pidFd = -1;
+        client.jobStatus = 0;
+        client.jobExited = false;
+        client.disconnected = false;
+        this->watchFd(socketFd, socketFd, EPOLLIN);
+    }
+}
+
+/*
+ * readRequest - drains the socket into the client's input buffer, then handles every complete frame
+ * Only one command per client runs at a time, frames sent while it runs wait in the buffer until it's done
+ */
+void commandServer::readRequest(serverClient &client) {
+    char buffer[65536];
+
+    while (!client.disconnected) {
+        ssize_t readCount = read(client.socketFd, buffer, sizeof(buffer));
+        if (readCount > 0) {
+            client.inputBuffer.append(buffer, readCount);
+            if (client.inputBuffer.size() > MAX_INPUT_BACKLOG) {
+                std::cerr << "kamish: dropping a client that sent more than it is allowed to queue" << std::endl;
+                this->disconnectClient(client);
+                return;
+            }
+            continue;
+        }
+        if (readCount == -1 && errno == EINTR)
+            continue;
+        if (readCount == -1 && errno == EAGAIN)
+            break;
+
+        // The client hung up, nobody is going to read the output of its command, so the command goes down too
+        this->disconnectClient(client);
+        return;
+    }
+
+    while (client.jobPID == -1 && !client.disconnected && client.inputBuffer.size() >= FRAME_HEADER_SIZE) {
+        uint32_t networkLength;
+        std::memcpy(&networkLength, client.inputBuffer.data() + 1, sizeof(networkLength));
+        size_t length = ntohl(networkLength);
+        // The length comes from the client, it's checked before anything waits for that many bytes
+        if (length > MAX_FRAME_PAYLOAD) {
+            std::cerr << "kamish: dropping a client that sent a " << length << " bytes frame" << std::endl;
+            this->disconnectClient(client);
+            return;
+        }
+        if (client.inputBuffer.size() < FRAME_HEADER_SIZE + length)
+            break;
+
+        unsigned char type = client.inputBuffer[0];
+        std::string payload = client.inputBuffer.substr(FRAME_HEADER_SIZE, length);
+        client.inputBuffer.erase(0, FRAME_HEADER_SIZE + length);
+
+        if (type == FRAME_DIRECTORY) {
+            client.directory = payload;
+        }
+        else if (type == FRAME_ENVIRONMENT) {
+            client.environment.push_back(payload);
+        }
+        else if (type == FRAME_COMMAND) {
+            this->startJob(client, payload);
+        }
+        else {
+            std::cerr << "kamish: dropping a client that sent an unknown frame" << std::endl;
+            this->disconnectClient(client);
+        }
+    }
+}
+
+/*
+ * startJob - runs one command line in a forked child of the server
+ * The child inherits everything the server has warmed up, sets up the requested directory and environment,
+ * and then goes through exactly the same parser and execute() calls as a line typed at the prompt
+ */
+void commandServer::startJob(serverClient &client, const std::string &commandLine) {
+    int stdoutPipe[2], stderrPipe[2];
+
+    if (pipe2(stdoutPipe, O_CLOEXEC) == -1) {
+        perror("kamish: pipe failed");
+        this->sendFrame(client, FRAME_STDERR, "kamish: the server could not create a pipe\n");
+        this->sendFrame(client, FRAME_EXIT, std::string(4, '\xff'));
+        return;
+    }
+    if (pipe2(stderrPipe, O_CLOEXEC) == -1) {
+        perror("kamish: pipe failed");
+        close(stdoutPipe[0]);
+        close(stdoutPipe[1]);
+        this->sendFrame(client, FRAME_STDERR, "kamish: the server could not create a pipe\n");
+        this->sendFrame(client, FRAME_EXIT, std::string(4, '\xff'));
+        return;
+    }
+
+    pid_t jobPID = fork();
+
+    if (jobPID == 0) {
+        // The command leads its own process group, so a hung up client can take the whole pipeline down with one kill()
+        setpgid(0, 0);
+
+        int nullFd = open("/dev/null", O_RDONLY);
+        dup2(nullFd, STDIN_FILENO);
+        dup2(stdoutPipe[1], STDOUT_FILENO);
+        dup2(stderrPipe[1], STDERR_FILENO);
+        close(nullFd);
+
+        // Descriptors of the server and of the other clients are none of this command's business
+        for (const auto &owner : this->fdOwners)
+            close(owner.first);
+        close(this->epollFd);
+
+        if (!client.directory.empty() && chdir(client.directory.c_str()) == -1) {
+            perror(("kamish: cannot change directory to " + client.directory).c_str());
+            exit(EXIT_FAILURE);
+        }
+        for (const auto &variable : client.environment) {
+            size_t equalPos = variable.find('=');
+            if (equalPos != std::string::npos)
+                setenv(variable.substr(0, equalPos).c_str(), variable.substr(equalPos + 1).c_str(), 1);
+        }
+
+        // environ, not the shell's copy of it, so that the overrides above reach the command
+        exit(this->shell.executeLine(commandLine, environ));
+    }
+
+    close(stdoutPipe[1]);
+    close(stderrPipe[1]);
+    client.directory.clear();
+    client.environment.clear();
+
+    if (jobPID == -1) {
+        perror("kamish: fork failed");
+        close(stdoutPipe[0]);
+        close(stderrPipe[0]);
+        this->sendFrame(client, FRAME_STDERR, "kamish: the server could not fork\n");
+        this->sendFrame(client, FRAME_EXIT, std::string(4, '\xff'));
+        return;
+    }
+
+    // The group is set on both sides of the fork(), a disconnect arriving before the child got to run must still kill(-jobPID) the right group
+    setpgid(jobPID, jobPID);
+
+    client.jobPID = jobPID;
+    client.jobExited = false;
+    client.stdoutFd = stdoutPipe[0];
+    client.stderrFd = stderrPipe[0];
+    fcntl(client.stdoutFd, F_SETFL, O_NONBLOCK);
+    fcntl(client.stderrFd, F_SETFL, O_NONBLOCK);
+    this->watchFd(client.stdoutFd, client.socketFd, EPOLLIN);
+    this->watchFd(client.stderrFd, client.socketFd, EPOLLIN);
+
+    // Without pidfds the command is reaped once both of its pipes are closed, see finishJobIfDone()
+    client.pidFd = static_cast<int>(syscall(SYS_pidfd_open, jobPID, 0));
+    if (client.pidFd != -1)
+        this->watchFd(client.pidFd, client.socketFd, EPOLLIN);
+}
+
+/*
+ * readJobOutput - relays whatever the command wrote as frames of the given type
+ * It stops early when the client is too far behind, updateInterest() then pauses the pipes until the backlog is sent
+ */
+void commandServer::readJobOutput(serverClient &client, int &pipeFd, frameType type) {
+    char buffer[65536];
+
+    while (client.outputBuffer.size() < OUTPUT_HIGH_WATER) {
+        ssize_t readCount = read(pipeFd, buffer, sizeof(buffer));
+        if (readCount > 0) {
+            if (!client.disconnected)
+                this->sendFrame(client, type, std::string(buffer, readCount));
+            continue;
+        }
+        if (readCount == -1 && errno == EINTR)
+            continue;
+        if (readCount == -1 && errno == EAGAIN)
+            break;
+
+        // End of file, every writer of this pipe is gone
+        this->forgetFd(pipeFd);
+        break;
+    }
+    this->updateInterest(client);
+}
+
+void commandServer::reapJob(serverClient &client) {
+    if (waitpid(client.jobPID, &client.jobStatus, WNOHANG) > 0) {
+        client.jobExited = true;
+        this->forgetFd(client.pidFd);
+    }
+}
+
+/*
+ * finishJobIfDone - the exit status is sent only when the command is reaped and both of its pipes are drained,
+ * so the client always gets all of the output before the status
+ */
+void commandServer::finishJobIfDone(serverClient &client) {
+    if (client.jobPID == -1 || client.stdoutFd != -1 || client.stderrFd != -1)
+        return;
+
+    if (!client.jobExited) {
+        if (client.pidFd != -1)
+            return;
+        // No pidfd, but both pipes are closed so the command is exiting, this wait is short
+        while (waitpid(client.jobPID, &client.jobStatus, 0) == -1 && errno == EINTR)
+            ;
+        client.jobExited = true;
+    }
+
+    // Killed commands report 128 + the signal number, like every other shell
+    int exitStatus = WIFEXITED(client.jobStatus) ? WEXITSTATUS(client.jobStatus) : 128 + WTERMSIG(client.jobStatus);
+    uint32_t networkStatus = htonl(static_cast<uint32_t>(exitStatus));
+    client.jobPID = -1;
+
+    if (client.disconnected)
+        return;
+    this->sendFrame(client, FRAME_EXIT, std::string(reinterpret_cast<const char *>(&networkStatus), sizeof(networkStatus)));
+
+    // The client may have queued its next request already
+    this->readRequest(client);
+}
+
+void commandServer::sendFrame(serverClient &client, frameType type, const std::string &payload) {
+    uint32_t networkLength = htonl(static_cast<uint32_t>(payload.length()));
+
+    client.outputBuffer += static_cast<char>(type);
+    client.outputBuffer.append(reinterpret_cast<const char *>(&networkLength), sizeof(networkLength));
+    client.outputBuffer += payload;
+    this->flushOutput(client);
+}
+
+void commandServer::flushOutput(serverClient &client) {
+    size_t sentTotal = 0;
+
+    while (sentTotal < client.outputBuffer.size()) {
+        ssize_t sentCount = send(client.socketFd, client.outputBuffer.data() + sentTotal, client.outputBuffer.size() - sentTotal, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sentCount > 0) {
+            sentTotal += sentCount;
+            continue;
+        }
+        if (sentCount == -1 && errno == EINTR)
+            continue;
+        if (sentCount == -1 && errno == EAGAIN)
+            break;
+
+        // The client is gone, same as a hang up
+        client.outputBuffer.clear();
+        sentTotal = 0;
+        if (!client.disconnected) {
+            client.disconnected = true;
+            epoll_ctl(this->epollFd, EPOLL_CTL_DEL, client.socketFd, nullptr);
+            if (client.jobPID != -1)
+                kill(-client.jobPID, SIGKILL);
+        }
+        break;
+    }
+    client.outputBuffer.erase(0, sentTotal);
+    this->updateInterest(client);
+}
+
+/*
+ * updateInterest - asks for EPOLLOUT only while there is a backlog, and pauses the command's pipes while the backlog is too big
+ */
+void commandServer::updateInterest(serverClient &client) {
+    struct epoll_event event;
+    bool paused = client.outputBuffer.size() >= OUTPUT_HIGH_WATER;
+
+    if (!client.disconnected) {
+        event.events = EPOLLIN;
+        if (!client.outputBuffer.empty())
+            event.events |= EPOLLOUT;
+        event.data.fd = client.socketFd;
+        epoll_ctl(this->epollFd, EPOLL_CTL_MOD, client.socketFd, &event);
+    }
+
+    for (int pipeFd : {client.stdoutFd, client.stderrFd}) {
+        if (pipeFd == -1)
+            continue;
+        event.events = 0;
+        if (!paused)
+            event.events = EPOLLIN;
+        event.data.fd = pipeFd;
+        epoll_ctl(this->epollFd, EPOLL_CTL_MOD, pipeFd, &event);
+    }
+}
+
+/*
+ * disconnectClient - stops listening to a client the server gave up on, its command is killed and reaped like after a hang up
+ */
+void commandServer::disconnectClient(serverClient &client) {
+    client.disconnected = true;
+    client.inputBuffer.clear();
+    epoll_ctl(this->epollFd, EPOLL_CTL_DEL, client.socketFd, nullptr);
+    if (client.jobPID != -1)
+        kill(-client.jobPID, SIGKILL);
+}
+
+void commandServer::dropClient(int socketFd) {
+    serverClient &client = this->clients[socketFd];
+
+    this->forgetFd(client.stdoutFd);
+    this->forgetFd(client.stderrFd);
+    this->forgetFd(client.pidFd);
+    this->forgetFd(client.socketFd);
+    this->clients.erase(socketFd);
+}
+
+
+/*----------------commandClient Class-------------------------------*/
+
+commandClient::commandClient(const std::string &givenSocketPath) : socketPath(givenSocketPath), socketFd(-1) {
+
+}
+
+commandClient::~commandClient() {
+    if (this->socketFd != -1)
+        close(this->socketFd);
+}
+
+/*
+ * Small helpers so that short reads and writes never cut a frame in half
+ */
+static bool writeAll(int fd, const char *data, size_t length) {
+    while (length) {
+        ssize_t writtenCount = write(fd, data, length);
+        if (writtenCount == -1 && errno == EINTR)
+            continue;
+        if (writtenCount <= 0)
+            return false;
+        data += writtenCount;
+        length -= writtenCount;
+    }
+    return true;
+}
+
+static bool readAll(int fd, char *data, size_t length) {
+    while (length) {
+        ssize_t readCount = read(fd, data, length);
+        if (readCount == -1 && errno == EINTR)
+            continue;
+        if (readCount <= 0)
+            return false;
+        data += readCount;
+        length -= readCount;
+    }
+    return true;
+}
+
+bool commandClient::sendFrame(frameType type, const std::string &payload) {
+    char header[FRAME_HEADER_SIZE];
+    uint32_t networkLength = htonl(static_cast<uint32_t>(payload.length()));
+
+    header[0] = static_cast<char>(type);
+    std::memcpy(header + 1, &networkLength, sizeof(networkLength));
+    return writeAll(this->socketFd, header, sizeof(header)) && writeAll(this->socketFd, payload.data(), payload.length());
+}
+
+bool commandClient::readFrame(unsigned char &type, std::string &payload) {
+    char header[FRAME_HEADER_SIZE];
+    uint32_t networkLength;
+
+    if (!readAll(this->socketFd, header, sizeof(header)))
+        return false;
+    type = static_cast<unsigned char>(header[0]);
+    std::memcpy(&networkLength, header + 1, sizeof(networkLength));
+
+    payload.resize(ntohl(networkLength));
+    return payload.empty() || readAll(this->socketFd, &payload[0], payload.length());
+}
+
+int commandClient::run(const std::string &commandLine, const std::vector<std::string> &environment, int repeat) {
+    struct sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (this->socketPath.length() >= sizeof(address.sun_path)) {
+        std::cerr << "kamish: socket path is too long: " << this->socketPath << std::endl;
+        return -1;
+    }
+    std::strcpy(address.sun_path, this->socketPath.c_str());
+
+    this->socketFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (this->socketFd == -1 || connect(this->socketFd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == -1) {
+        perror(("kamish: cannot connect to " + this->socketPath).c_str());
+        return -1;
+    }
+
+    char cwd[PATH_MAX];
+    std::string directory = getcwd(cwd, sizeof(cwd)) ? cwd : "";
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int exitStatus = -1;
+    for (int i = 0; i < repeat; i++) {
+        bool sent = directory.empty() || this->sendFrame(FRAME_DIRECTORY, directory);
+        for (const auto &variable : environment)
+            sent = sent && this->sendFrame(FRAME_ENVIRONMENT, variable);
+        if (!sent || !this->sendFrame(FRAME_COMMAND, commandLine)) {
+            perror("kamish: sending the request failed");
+            return -1;
+        }
+
+        // Relay the output as it comes, until the exit status closes the answer
+        unsigned char type;
+        std::string payload;
+        exitStatus = -1;
+        while (exitStatus == -1) {
+            if (!this->readFrame(type, payload)) {
+                std::cerr << "kamish: the server closed the connection" << std::endl;
+                return -1;
+            }
+            if (type == FRAME_STDOUT)
+                writeAll(STDOUT_FILENO, payload.data(), payload.length());
+            else if (type == FRAME_STDERR)
+                writeAll(STDERR_FILENO, payload.data(), payload.length());
+            else if (type == FRAME_EXIT && payload.length() == sizeof(uint32_t)) {
+                uint32_t networkStatus;
+                std::memcpy(&networkStatus, payload.data(), sizeof(networkStatus));
+                exitStatus = static_cast<int>(ntohl(networkStatus)) & 0xff;
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (repeat > 1) {
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        std::cerr << repeat << " requests in " << seconds << "s, " << static_cast<long long>(repeat / seconds) << " requests/s" << std::endl;
+    }
+    return exitStatus;
+}
@@ -0,0 +1,111 @@
+#ifndef __SERVER__
+#define __SERVER__
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <unistd.h>
+#include <sys/types.h>
+#include "shell.hpp"
+
+/*
+ * The wire format shared by the server and the client, every message is a frame:
+ * [1 byte type][4 bytes big-endian payload length][payload]
+ * A request is any number of DIRECTORY and ENVIRONMENT frames followed by the COMMAND frame that triggers the run
+ * The answer is any number of STDOUT and STDERR frames, in the order the output was produced, closed by one EXIT frame
+ */
+enum frameType : unsigned char {
+    FRAME_DIRECTORY = 'D',
+    FRAME_ENVIRONMENT = 'V',
+    FRAME_COMMAND = 'C',
+    FRAME_STDOUT = 'O',
+    FRAME_STDERR = 'E',
+    FRAME_EXIT = 'X'
+};
+
+/*
+ * commandServer - "kamish --serve /path.sock"
+ * Accepts command lines over a Unix domain socket and runs them through the usual parser and Command::execute() machinery
+ * The server is a long lived shell, so a request costs one fork() from a warm process instead of starting a whole new shell
+ * All the clients, the output of their commands and the commands themselves are multiplexed in a single epoll loop
+ */
+class commandServer {
+    private:
+        // Everything the server knows about one connection, including the command it's running, if any
+        struct serverClient {
+            int socketFd;
+            std::string inputBuffer;
+            std::string outputBuffer;
+
+            // The request being assembled
+            std::string directory;
+            std::vector<std::string> environment;
+
+            // The running command, its output pipes and its pidfd, -1 when there is no command running
+            pid_t jobPID;
+            int stdoutFd;
+            int stderrFd;
+            int pidFd;
+            int jobStatus;
+            bool jobExited;
+
+            // Set when the client hung up, the connection is torn down once its command is reaped
+            bool disconnected;
+        };
+
+        Shell &shell;
+        std::string socketPath;
+        int listenFd;
+        int epollFd;
+
+        std::map<int, serverClient> clients;
+        // Maps every descriptor in the epoll set (sockets, pipes and pidfds) back to the socket of its client
+        std::unordered_map<int, int> fdOwners;
+
+        void watchFd(int fd, int owner, unsigned int events);
+        void forgetFd(int &fd);
+
+        void acceptClients();
+        void readRequest(serverClient &client);
+        void startJob(serverClient &client, const std::string &commandLine);
+        void readJobOutput(serverClient &client, int &pipeFd, frameType type);
+        void reapJob(serverClient &client);
+        void finishJobIfDone(serverClient &client);
+        void sendFrame(serverClient &client, frameType type, const std::string &payload);
+        void flushOutput(serverClient &client);
+        void updateInterest(serverClient &client);
+        void disconnectClient(serverClient &client);
+        void dropClient(int socketFd);
+
+    public:
+        commandServer(Shell &givenShell, const std::string &givenSocketPath);
+        ~commandServer();
+
+        // Binds the socket and serves clients forever, returns only if the socket can't be set up
+        int serve();
+};
+
+/*
+ * commandClient - "kamish --connect /path.sock [-e NAME=VALUE]... [--repeat N] command..."
+ * Sends one command line (with the current directory and the given environment overrides) and relays the output and the exit status
+ * With --repeat, the same request is sent N times over the same connection and the throughput is reported on stderr
+ */
+class commandClient {
+    private:
+        std::string socketPath;
+        int socketFd;
+
+        bool sendFrame(frameType type, const std::string &payload);
+        bool readFrame(unsigned char &type, std::string &payload);
+
+    public:
+        commandClient(const std::string &givenSocketPath);
+        ~commandClient();
+
+        // Sends the request and relays its answer, returns the exit status of the command, or -1 if the connection failed
+        int run(const std::string &commandLine, const std::vector<std::string> &environment, int repeat = 1);
+};
+
+#endif
@@ -2,10 +2,18 @@
 #include "command.hpp"
 #include <limits.h> // For PATH_MAX
 
-Shell::Shell(char **environPtr) : environ(environPtr){
+Shell::Shell(char **environPtr) : environ(environPtr), optimizeCommands(true), explainOnly(false) {
 
 }
 
+void Shell::setOptimize(bool enabled) {
+    this->optimizeCommands = enabled;
+}
+
+void Shell::setExplain(bool enabled) {
+    this->explainOnly = enabled;
+}
+
 
 std::string Shell::getPrompt() {
     char cwd[PATH_MAX];
@@ -38,7 +46,26 @@ std::string Shell::getPrompt() {
     return "kamish$ ";
 }
 
-void Shell::run() {
+/*
+ * loadConfiguration - the rc file lives in the home directory, its snapshot right next to it
+ */
+void Shell::loadConfiguration() {
+    const char *home = getenv("HOME");
+    if (!home)
+        return;
+
+    std::string rcPath = std::string(home) + "/.kamishrc";
+    this->configuration.load(rcPath, rcPath + ".snapshot");
+
+    // Exporting new variables may have moved the environment array, the commands must get the current one
+    this->environ = ::environ;
+}
+
+int Shell::run() {
+    // Without a terminal there is no line to edit and no history to scroll, so readline is never even set up
+    if (!isatty(STDIN_FILENO))
+        return this->runStream(STDIN_FILENO);
+
     this->isRunning = true;
 
     // The shell's main loop, will run until ctrl + D is pressed or if the user types the built-in "exit"
@@ -58,11 +85,7 @@ void Shell::run() {
         }
 
         free(cInput);
-        std::unique_ptr<Command> currentCommand = this->commandParser(input);
-        if (!this->isRunning || !currentCommand)
-            continue;
-
-        int status = currentCommand->execute(this->environ);
+        this->executeLine(input, this->environ);
     }
 
     clear_history();
@@ -70,80 +93,274 @@ void Shell::run() {
     rl_clear_history();
     rl_free_undo_list();
     #endif
+    return 0;
 }
-std::vector<std::string> Shell::tokenize(const std::string &input) {
-    std::vector<std::string> tokens;
-    std::string currentToken;
-    
-    bool inQuotes = false;
-    char quoteChar = 0;
 
+/*
+ * runStream - the non interactive loop, no prompt, no history, just one line after the other
+ * Lines starting with "#" are comments, which also takes care of a "#!" line at the top of a script
+ */
+int Shell::runStream(std::istream &input) {
+    std::string line;
+    int status = 0;
 
-    for (size_t i = 0; i < input.length(); i++) {
-        char c = input[i];
+    this->isRunning = true;
+    while (this->isRunning && std::getline(input, line))
+        status = this->runScriptLine(line, status);
+    return status;
+}
 
+/*
+ * Stdin is shared with the commands, in "printf 'read x\nhello\n' | kamish" the second line is read's input, not a command
+ * A buffered std::getline() would have swallowed it already, so the lines are read straight from the descriptor, like bash does
+ */
+int Shell::runStream(int inputFd) {
+    std::string line;
+    int status = 0;
 
-        if (inQuotes) {
-            // STATE: INSIDE QUOTES
+    this->isRunning = true;
+    while (this->isRunning && readLine(inputFd, line))
+        status = this->runScriptLine(line, status);
+    return status;
+}
 
-            if (c == quoteChar) {
-                // Found the closing quote. Switch back to Normal.
-                inQuotes = false;
-                // Note: We do NOT add 'c' to currentToken. This effectively strips the quote!
-            } else {
-                // Inside quotes, spaces are just text.
-                currentToken += c;
+int Shell::runScriptLine(const std::string &line, int status) {
+    std::string trimmedLine = this->trimInput(line);
+    if (trimmedLine.empty() || trimmedLine[0] == '#')
+        return status;
+    return this->executeLine(trimmedLine, this->environ);
+}
+
+/*
+ * readLine - reads one line, without its newline, and not a byte more
+ * A seekable input (a file redirected to stdin) is read a block at a time and the offset is moved back to the end of the line,
+ * anything else, a pipe or a socket, can't be rewound, so it's read one byte at a time
+ */
+bool Shell::readLine(int inputFd, std::string &line) {
+    line.clear();
+    bool seekable = lseek(inputFd, 0, SEEK_CUR) != -1;
+    char buffer[4096];
+
+    while (true) {
+        ssize_t bytesRead = read(inputFd, buffer, seekable ? sizeof(buffer) : 1);
+        if (bytesRead == -1 && errno == EINTR)
+            continue;
+        if (bytesRead <= 0)
+            return !line.empty();
+
+        const char *newline = static_cast<const char *>(memchr(buffer, '\n', bytesRead));
+        if (!newline) {
+            line.append(buffer, bytesRead);
+            continue;
+        }
+
+        line.append(buffer, newline - buffer);
+        ssize_t readAhead = bytesRead - (newline - buffer + 1);
+        if (readAhead)
+            lseek(inputFd, -readAhead, SEEK_CUR);
+        return true;
+    }
+}
+
+/*
+ * executeLine - one command line, from text to exit status
+ * Shared by the interactive loop and the server mode, so both run commands through exactly the same parser and execute() calls
+ */
+int Shell::executeLine(const std::string &input, char **environPtr) {
+    std::unique_ptr<Command> currentCommand = this->commandParser(input);
+    if (!currentCommand)
+        return 0;
+
+    // With --explain nothing runs, the tree is printed as parsed, then as the optimizer left it
+    if (this->explainOnly) {
+        std::cout << "original:" << std::endl;
+        currentCommand->explain(std::cout, 1);
+    }
+
+    // The optimizer rewrites the tree into a cheaper one that behaves the same, "cat f | cmd" into "cmd < f" and the likes
+    if (this->optimizeCommands)
+        Command::optimizeTree(currentCommand);
+
+    if (this->explainOnly) {
+        std::cout << (this->optimizeCommands ? "optimized:" : "optimized: (optimizer off)") << std::endl;
+        currentCommand->explain(std::cout, 1);
+        return 0;
+    }
+
+    return currentCommand->execute(environPtr);
+}
+
+/*
+ * tokenize - splits a simple command into its arguments
+ * The scanner finds the next blank, quote or '$' in one go, and everything before it is appended to the token as a single span,
+ * so a long argument list costs a few vector steps per argument instead of a branch and an append per character
+ */
+std::vector<std::string> Shell::tokenize(const std::string &input, std::vector<arithmeticExpression::literalRanges> *literals) {
+    std::vector<std::string> tokens;
+    std::string currentToken;
+    // Where the single quoted text of the current token sits, so that the expansion stage can leave it alone
+    arithmeticExpression::literalRanges currentLiterals;
+    const unsigned specialClasses = characterScanner::CLASS_SPACE | characterScanner::CLASS_QUOTE | characterScanner::CLASS_DOLLAR;
+
+    size_t i = 0;
+    while (i < input.length()) {
+        // STATE: NORMAL (OUTSIDE QUOTES), the whole span up to the next special character is plain text
+        size_t specialPos = characterScanner::findFirstOf(input, i, specialClasses);
+        currentToken.append(input, i, specialPos - i);
+        if (specialPos == input.length())
+            break;
+
+        char c = input[specialPos];
+        i = specialPos + 1;
+
+        if (c == '"' || c == '\'') {
+            // STATE: INSIDE QUOTES, spaces are just text, so everything up to the closing quote is appended at once
+            // Note: the quotes themselves are NOT added to currentToken, this effectively strips them
+            size_t closingPos = input.find(c, i);
+            if (closingPos == std::string::npos)
+                closingPos = input.length();
+            if (c == '\'' && closingPos > i)
+                currentLiterals.push_back(std::make_pair(currentToken.length(), currentToken.length() + closingPos - i));
+            currentToken.append(input, i, closingPos - i);
+            i = closingPos + 1;
+        }
+        else if (c == '$') {
+            // An arithmetic expansion is kept whole, spaces included, the expansion stage evaluates it later
+            if (!input.compare(specialPos, 3, "$((")) {
+                size_t endPos = arithmeticExpression::findClosingParens(input, specialPos);
+                if (endPos == std::string::npos)
+                    endPos = input.length() - 1;
+                currentToken.append(input, specialPos, endPos - specialPos + 1);
+                i = endPos + 1;
             }
-        } 
-        else {
-            // STATE: NORMAL (OUTSIDE QUOTES)
-            if (c == '"' || c == '\'') {
-                // Found an opening quote. Switch to Quote Mode.
-                inQuotes = true;
-                quoteChar = c;
-            } 
-            else if (std::isspace(c)) {
-                // Found a space outside quotes. This ends the token.
-                if (!currentToken.empty()) {
-                    tokens.push_back(currentToken);
-                    currentToken.clear();
-                }
-            } 
             else {
-                // Just a normal letter/number
                 currentToken += c;
             }
         }
+        else {
+            // A blank outside quotes ends the token, and the run of blanks after it is skipped as a whole
+            if (!currentToken.empty()) {
+                tokens.push_back(currentToken);
+                currentToken.clear();
+                if (literals)
+                    literals->push_back(currentLiterals);
+            }
+            currentLiterals.clear();
+            i = characterScanner::findFirstNotOf(input, i, characterScanner::CLASS_SPACE);
+        }
     }
 
     // Push the final token (if the string didn't end with a space)
     if (!currentToken.empty()) {
         tokens.push_back(currentToken);
+        if (literals)
+            literals->push_back(currentLiterals);
     }
 
     return tokens;
 }
 
 /*
- * trimInput - trims leading and trailing spaces from the given input
+ * trimInput - trims leading and trailing blanks from the given input
  */
 std::string Shell::trimInput(const std::string &input) {
-    // Use find_first_not_of() to find the first character in the string that is not a space
-    size_t firstCharPos = input.find_first_not_of(' ');
+    // Ask the scanner for the first character in the string that is not a blank
+    size_t firstCharPos = characterScanner::findFirstNotOf(input, 0, characterScanner::CLASS_SPACE);
 
-    // If we couldn't find any, the input is just a series of spaces, we return an empty string to signal it
-    if (firstCharPos == std::string::npos)
+    // If we couldn't find any, the input is just a series of blanks, we return an empty string to signal it
+    if (firstCharPos == input.length())
         return "";
 
-    // Use find_last_not_of() to find the last character in the string that is not a space
-    size_t lastCharPos = input.find_last_not_of(' ');
+    // Trailing blanks are a handful at most, walking back from the end is enough to find the last character that is not one
+    size_t lastCharPos = input.length() - 1;
+    while (characterScanner::classOf(input[lastCharPos]) & characterScanner::CLASS_SPACE)
+        lastCharPos--;
 
-    // Use substr(), the index of the first character and the index of the last character to trim the leading and trailing spaces
+    // Use substr(), the index of the first character and the index of the last character to trim the leading and trailing blanks
     // substr() takes the length of the string as a second argument, naturally the length of the trimmed input is last - first + 1
     std::string trimmedInput = input.substr(firstCharPos, (lastCharPos - firstCharPos + 1));
     return trimmedInput;
 }
 
+/*
+ * isGroupBrace - '{' and '}' only group commands when they are words of their own,
+ * "echo {a,b}" or "find . -exec ls {} ;" keep them as plain characters of an argument
+ */
+static bool isGroupBrace(const std::string &input, size_t i) {
+    const unsigned boundaryClasses = characterScanner::CLASS_SPACE | characterScanner::CLASS_OPERATOR;
+    bool startsWord = !i || (characterScanner::classOf(input[i - 1]) & boundaryClasses);
+    bool endsWord = i + 1 == input.length() || (characterScanner::classOf(input[i + 1]) & boundaryClasses);
+    return startsWord && endsWord;
+}
+
+/*
+ * findOperator - finds the first occurrence of the given operator that actually is an operator
+ * Unlike a plain find(), it skips over quoted text, arithmetic expansions and "{ ... }" groups,
+ * so "$(( a > b ))", "echo 'a;b'" or "with nice=5 -- { a | b }" are never split
+ * Only quotes, '$', braces and the characters of op's class are looked at, so op has to start with an operator character or a blank
+ */
+size_t Shell::findOperator(const std::string &input, const std::string &op) {
+    const unsigned candidateClasses = characterScanner::CLASS_QUOTE | characterScanner::CLASS_DOLLAR | characterScanner::CLASS_GROUP |
+        characterScanner::classOf(op[0]);
+
+    for (size_t i = characterScanner::findFirstOf(input, 0, candidateClasses); i < input.length();
+            i = characterScanner::findFirstOf(input, i + 1, candidateClasses)) {
+        char c = input[i];
+
+        if (c == '"' || c == '\'') {
+            // Inside quotes, only the closing quote matters
+            i = input.find(c, i + 1);
+            if (i == std::string::npos)
+                return std::string::npos;
+        }
+        else if (!input.compare(i, 3, "$((")) {
+            // Jump straight to the end of the expansion, if it's never closed there's no operator left to find
+            i = arithmeticExpression::findClosingParens(input, i);
+            if (i == std::string::npos)
+                return std::string::npos;
+        }
+        else if (c == '{' && isGroupBrace(input, i)) {
+            // A group is one unit to the levels above it, its operators belong to the line inside it
+            i = this->findClosingBrace(input, i);
+            if (i == std::string::npos)
+                return std::string::npos;
+        }
+        else if (!input.compare(i, op.length(), op)) {
+            return i;
+        }
+    }
+    return std::string::npos;
+}
+
+/*
+ * findClosingBrace - the same walk as findOperator(), counting the nested groups on the way
+ */
+size_t Shell::findClosingBrace(const std::string &input, size_t openPos) {
+    const unsigned candidateClasses = characterScanner::CLASS_QUOTE | characterScanner::CLASS_DOLLAR | characterScanner::CLASS_GROUP;
+    int depth = 0;
+
+    for (size_t i = openPos; i < input.length(); i = characterScanner::findFirstOf(input, i + 1, candidateClasses)) {
+        char c = input[i];
+
+        if (c == '"' || c == '\'') {
+            i = input.find(c, i + 1);
+            if (i == std::string::npos)
+                return std::string::npos;
+        }
+        else if (!input.compare(i, 3, "$((")) {
+            i = arithmeticExpression::findClosingParens(input, i);
+            if (i == std::string::npos)
+                return std::string::npos;
+        }
+        else if ((c == '{' || c == '}') && isGroupBrace(input, i)) {
+            depth += (c == '{') ? 1 : -1;
+            if (!depth)
+                return i;
+        }
+    }
+    return std::string::npos;
+}
+
 /*
  * commandParser - The GOD function in this whole project
  * It's a recursive descent parser, divides and conquers, like all the great leaders
@@ -166,9 +383,13 @@ std::unique_ptr<Command> Shell::commandParser(std::string input) {
         return nullptr;
     }
 
+    // A "{ ... }" group around the whole input is just the line inside it, it's how "with" covers a whole pipeline
+    if (trimmedInput[0] == '{' && isGroupBrace(trimmedInput, 0) && this->findClosingBrace(trimmedInput, 0) == trimmedInput.length() - 1)
+        return commandParser(trimmedInput.substr(1, trimmedInput.length() - 2));
+
     // This is the interesting part, stay with me now
     // If we find ";", this means we have a composite command on our hands
-    size_t colonPos = trimmedInput.find(";");
+    size_t colonPos = this->findOperator(trimmedInput, ";");
     if (colonPos != std::string::npos) {
         // We divide the input into left of the ";" and the right of it using substr() and andPos
         std::string leftString = trimmedInput.substr(0, colonPos);
@@ -180,6 +401,10 @@ std::unique_ptr<Command> Shell::commandParser(std::string input) {
         std::unique_ptr<Command> leftCommand = commandParser(leftString);
         std::unique_ptr<Command> rightCommand = commandParser(rightString);
 
+        // "a ;" or "exit ; a" leave one side empty, the sequence is then just the other side
+        if (!leftCommand || !rightCommand)
+            return leftCommand ? std::move(leftCommand) : std::move(rightCommand);
+
         // Allocate memory on the heap for an sequenceCommand object, use move semantics to move ownership from the left/rightCommand to the constructor
         // The constructor in turn moves the ownership from itself to the instance private members
         sequenceCommand *rawSequencePtr = new sequenceCommand(std::move(leftCommand), std::move(rightCommand));
@@ -189,7 +414,7 @@ std::unique_ptr<Command> Shell::commandParser(std::string input) {
     }
 
     // If we find "&&", this means we have an AND command on our hands
-    size_t andPos = trimmedInput.find("&&");
+    size_t andPos = this->findOperator(trimmedInput, "&&");
     if (andPos != std::string::npos) {
         // We divide the input into left of the "&&" and the right of it using substr() and andPos
         std::string leftString = trimmedInput.substr(0, andPos);
@@ -200,6 +425,8 @@ std::unique_ptr<Command> Shell::commandParser(std::string input) {
         // Until we are left with and elementary command
         std::unique_ptr<Command> leftCommand = commandParser(leftString);
         std::unique_ptr<Command> rightCommand = commandParser(rightString);
+        if (!this->hasOperands(leftCommand, rightCommand, leftString, rightString, "&&"))
+            return nullptr;
 
         // Allocate memory on the heap for an andCommand object, use move semantics to move ownership from the left/rightCommand to the constructor
         // The constructor in turn moves the ownership from itself to the instance private members
@@ -213,7 +440,7 @@ std::unique_ptr<Command> Shell::commandParser(std::string input) {
     }
     
     // If we find "||", this means we have an OR command on our hands
-    size_t orPos = trimmedInput.find("||");
+    size_t orPos = this->findOperator(trimmedInput, "||");
     if (orPos != std::string::npos) {
         // We divide the input into left of the "||" and the right of it using substr() and andPos
         std::string leftString = trimmedInput.substr(0, orPos);
@@ -224,6 +451,8 @@ std::unique_ptr<Command> Shell::commandParser(std::string input) {
         // Until we are left with and elementary command
         std::unique_ptr<Command> leftCommand = commandParser(leftString);
         std::unique_ptr<Command> rightCommand = commandParser(rightString);
+        if (!this->hasOperands(leftCommand, rightCommand, leftString, rightString, "||"))
+            return nullptr;
 
         // Allocate memory on the heap for an orCommand object, use move semantics to move ownership from the left/rightCommand to the constructor
         // The constructor in turn moves the ownership from itself to the instance private members
@@ -235,8 +464,31 @@ std::unique_ptr<Command> Shell::commandParser(std::string input) {
         return genericCmdPtr;
     }
 
+    // If the pipeline starts with the "timeout" built-in, the deadline covers everything after the duration, up to the end of the pipeline
+    // "timeout --default DURATION" is left alone, it's a plain built-in that sets the timeout of every other command
+    if (!trimmedInput.compare(0, 8, "timeout ")) {
+        size_t durationStart = trimmedInput.find_first_not_of(' ', 8);
+        size_t durationEnd = trimmedInput.find(' ', durationStart);
+        std::string duration = trimmedInput.substr(durationStart, durationEnd - durationStart);
+
+        if (duration != "--default") {
+            if (durationEnd == std::string::npos) {
+                std::cerr << "timeout: expected a command after the duration" << std::endl;
+                return nullptr;
+            }
+
+            std::unique_ptr<Command> resultingCommand = commandParser(trimmedInput.substr(durationEnd));
+            if (!resultingCommand)
+                return nullptr;
+
+            timeoutCommand *rawTimeoutPtr = new timeoutCommand(std::move(resultingCommand), duration);
+            std::unique_ptr<Command> genericCmdPtr(rawTimeoutPtr);
+            return genericCmdPtr;
+        }
+    }
+
     // If we find "|", this means we have a pipe command on our hands
-    size_t pipePos = trimmedInput.find("|");
+    size_t pipePos = this->findOperator(trimmedInput, "|");
     if (pipePos != std::string::npos) {
         // We divide the input into left of the "|" and the right of it using substr() and andPos
         std::string leftString = trimmedInput.substr(0, pipePos);
@@ -247,6 +499,8 @@ std::unique_ptr<Command> Shell::commandParser(std::string input) {
         // Until we are left with and elementary command
         std::unique_ptr<Command> leftCommand = commandParser(leftString);
         std::unique_ptr<Command> rightCommand = commandParser(rightString);
+        if (!this->hasOperands(leftCommand, rightCommand, leftString, rightString, "|"))
+            return nullptr;
 
         // Allocate memory on the heap for a pipeCommand object, use move semantics to move ownership from the left/rightCommand to the constructor
         // The constructor in turn moves the ownership from itself to the instance private members
@@ -259,8 +513,31 @@ std::unique_ptr<Command> Shell::commandParser(std::string input) {
         return genericCmdPtr;
     }
 
+    // The "with" built-in binds to a single stage, it's parsed once the pipes are split, so "with nice=10 -- a | b" only renices a
+    // and every stage is still forked straight from the shell, "with nice=10 -- { a | b }" covers the whole pipeline
+    if (!trimmedInput.compare(0, 5, "with ")) {
+        size_t separatorPos = this->findOperator(trimmedInput, " -- ");
+        if (separatorPos == std::string::npos) {
+            std::cerr << "with: expected \"--\" before the command" << std::endl;
+            return nullptr;
+        }
+
+        // Everything between "with" and "--" is an option, everything after it is the command
+        // "with -- cmd" has no options at all, the separator starts right at the blank after "with"
+        std::vector<std::string> options;
+        if (separatorPos > 5)
+            options = this->tokenize(trimmedInput.substr(5, separatorPos - 5));
+        std::unique_ptr<Command> resultingCommand = commandParser(trimmedInput.substr(separatorPos + 4));
+        if (!resultingCommand)
+            return nullptr;
+
+        withCommand *rawWithPtr = new withCommand(std::move(resultingCommand), options);
+        std::unique_ptr<Command> genericCmdPtr(rawWithPtr);
+        return genericCmdPtr;
+    }
+
     // If we find ">>", this means we have a redirect and append command on our hands
-    size_t appendPos = trimmedInput.find(">>");
+    size_t appendPos = this->findOperator(trimmedInput, ">>");
     if (appendPos != std::string::npos) {
         // We divide the input into left of the "|" and the right of it using substr() and andPos
         std::string leftString = trimmedInput.substr(0, appendPos);
@@ -281,7 +558,7 @@ std::unique_ptr<Command> Shell::commandParser(std::string input) {
     
 
     // If we find ">", this means we have a redirect and truncate command on our hands
-    size_t truncPos = trimmedInput.find(">");
+    size_t truncPos = this->findOperator(trimmedInput, ">");
     if (truncPos != std::string::npos) {
         // We divide the input into left of the ">" and the right of it using substr() and andPos
         std::string leftString = trimmedInput.substr(0, truncPos);
@@ -301,7 +578,7 @@ std::unique_ptr<Command> Shell::commandParser(std::string input) {
     }
     
     // If we find "<", this means we have a redirect and read command on our hands
-    size_t readPos = trimmedInput.find("<");
+    size_t readPos = this->findOperator(trimmedInput, "<");
     if (readPos != std::string::npos) {
         // We divide the input into left of the "<" and the right of it using substr() and andPos
         std::string leftString = trimmedInput.substr(0, readPos);
@@ -322,8 +599,31 @@ std::unique_ptr<Command> Shell::commandParser(std::string input) {
 
     else {
         // This is our base case, each recursive call leads to this
+        std::vector<arithmeticExpression::literalRanges> literals;
+        std::vector<std::string> arguments = this->tokenize(trimmedInput, &literals);
+
+        // An alias replaces the first word, as written, a quoted alias name is not expanded, just like bash
+        // The result is parsed again, so an alias can stand for a whole pipeline
+        std::string firstWord = trimmedInput.substr(0, trimmedInput.find_first_of(" \t"));
+        const std::string *alias = this->configuration.findAlias(firstWord);
+        if (alias && !this->expandingNames.count(firstWord)) {
+            this->expandingNames.insert(firstWord);
+            std::unique_ptr<Command> expandedCommand = commandParser(*alias + trimmedInput.substr(firstWord.length()));
+            this->expandingNames.erase(firstWord);
+            return expandedCommand;
+        }
+
+        // A function call is replaced by the body of the function, with the arguments in place of $1, $2...
+        const std::string *function = arguments.empty() ? nullptr : this->configuration.findFunction(arguments[0]);
+        if (function && !this->expandingNames.count(arguments[0])) {
+            this->expandingNames.insert(arguments[0]);
+            std::unique_ptr<Command> expandedCommand = commandParser(this->expandFunction(*function, arguments, literals));
+            this->expandingNames.erase(arguments[0]);
+            return expandedCommand;
+        }
+
         // We build a simple command from the tokenized input
-        simpleCommand *rawSimplePtr = new simpleCommand(this->tokenize(trimmedInput));
+        simpleCommand *rawSimplePtr = new simpleCommand(arguments, literals);
         
         // And just like before, we wrap the simpleCommand by a generic unique pointer, consistent programming!
         std::unique_ptr<Command> genericCmdPtr(rawSimplePtr);
@@ -331,4 +631,71 @@ std::unique_ptr<Command> Shell::commandParser(std::string input) {
     }
 }
 
+/*
+ * hasOperands - "echo hi |" or "&& ls" have nothing on one side of the operator, that's a syntax error and nothing runs
+ * A side that is there but failed to parse has already printed its own error
+ */
+bool Shell::hasOperands(const std::unique_ptr<Command> &leftCommand, const std::unique_ptr<Command> &rightCommand,
+        const std::string &leftString, const std::string &rightString, const std::string &op) {
+    if (leftCommand && rightCommand)
+        return true;
+    if (this->trimInput(leftString).empty() || this->trimInput(rightString).empty())
+        std::cerr << "kamish: syntax error near \"" << op << "\"" << std::endl;
+    return false;
+}
+
+/*
+ * expandFunction - substitutes the positional parameters of a function body
+ * $0 is the function name, $1 to $9 its arguments, $# their count and $@ all of them
+ * Arguments are put back in quotes, so an argument with spaces stays a single argument once the body is tokenized
+ * The parts that were single quoted go back in single quotes, the rest in double quotes, so expansion still skips exactly the same text
+ */
+std::string Shell::expandFunction(const std::string &body, const std::vector<std::string> &arguments,
+        const std::vector<arithmeticExpression::literalRanges> &literals) {
+    auto quote = [&arguments, &literals](size_t index) {
+        const std::string &argument = arguments[index];
+        std::string quoted;
+        size_t copiedUpTo = 0;
+        auto quotePart = [&quoted](const std::string &part) {
+            char quoteChar = (part.find('"') == std::string::npos) ? '"' : '\'';
+            quoted += quoteChar + part + quoteChar;
+        };
+
+        if (index < literals.size()) {
+            for (const auto &range : literals[index]) {
+                if (range.first > copiedUpTo)
+                    quotePart(argument.substr(copiedUpTo, range.first - copiedUpTo));
+                quoted += "'" + argument.substr(range.first, range.second - range.first) + "'";
+                copiedUpTo = range.second;
+            }
+        }
+        if (copiedUpTo < argument.length() || quoted.empty())
+            quotePart(argument.substr(copiedUpTo));
+        return quoted;
+    };
+    std::string expandedBody;
+
+    for (size_t i = 0; i < body.length(); i++) {
+        char next = (i + 1 < body.length()) ? body[i + 1] : 0;
 
+        if (body[i] != '$' || !(std::isdigit(static_cast<unsigned char>(next)) || next == '@' || next == '#')) {
+            expandedBody += body[i];
+            continue;
+        }
+
+        if (next == '#') {
+            expandedBody += std::to_string(arguments.size() - 1);
+        }
+        else if (next == '@') {
+            for (size_t j = 1; j < arguments.size(); j++)
+                expandedBody += (j > 1 ? " " : "") + quote(j);
+        }
+        else {
+            size_t position = next - '0';
+            if (position < arguments.size())
+                expandedBody += position ? quote(position) : arguments[0];
+        }
+        i++;
+    }
+    return expandedBody;
+}
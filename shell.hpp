@@ -20,7 +20,10 @@
 #include <unistd.h>
 #include <sstream>
 #include <sys/wait.h>
+#include <unordered_set>
 #include "command.hpp"
+#include "config.hpp"
+#include "scanner.hpp"
 #include <readline/readline.h>
 #include <readline/history.h>
 
@@ -29,14 +32,44 @@ class Shell {
         bool isRunning;
         std::vector<std::string> dirPath;
         char **environ;
+        rcConfiguration configuration;
+        // Run the optimizer pass on every parsed line, and with explainOnly, print the plans instead of executing them
+        bool optimizeCommands;
+        bool explainOnly;
+        // The aliases and functions being expanded right now, so that an alias using its own name doesn't expand forever
+        std::unordered_set<std::string> expandingNames;
         
         std::string trimInput(const std::string &input);
-        std::vector<std::string> tokenize(const std::string &input);
+        // literals, when given, gets the single quoted ranges of each token, see arithmeticExpression::expandWord()
+        std::vector<std::string> tokenize(const std::string &input, std::vector<arithmeticExpression::literalRanges> *literals = nullptr);
+        size_t findOperator(const std::string &input, const std::string &op);
+        // The position of the "}" closing the "{" group at openPos, npos if it's never closed
+        size_t findClosingBrace(const std::string &input, size_t openPos);
         std::unique_ptr<Command> commandParser(std::string input);
+        // False, after printing the syntax error if there is one, when a side of the binary operator op didn't parse to a command
+        bool hasOperands(const std::unique_ptr<Command> &leftCommand, const std::unique_ptr<Command> &rightCommand,
+                const std::string &leftString, const std::string &rightString, const std::string &op);
         std::string getPrompt();
+        // One line of a script or of stdin, skipping blanks and comments, returns its status or the given one
+        int runScriptLine(const std::string &line, int status);
+        static bool readLine(int inputFd, std::string &line);
+        std::string expandFunction(const std::string &body, const std::vector<std::string> &arguments,
+                const std::vector<arithmeticExpression::literalRanges> &literals);
     public:
         Shell(char** environPtr);
-        void run();
+        // Loads ~/.kamishrc, through its snapshot when possible
+        void loadConfiguration();
+        // --no-optimize and --explain
+        void setOptimize(bool enabled);
+        void setExplain(bool enabled);
+        // The interactive loop when stdin is a terminal, a plain line by line loop otherwise, returns the last status
+        int run();
+        // Runs every line of the given stream, used for scripts
+        int runStream(std::istream &input);
+        // The same for stdin when it's not a terminal, never reading past the current line, what's left is the commands' input
+        int runStream(int inputFd);
+        // Parses and executes one command line against the given environment, returns the status of the command
+        int executeLine(const std::string &input, char **environPtr);
         void executeCommand(const std::vector<std::string> &arguments);
 };
 
@@ -0,0 +1,222 @@
+#include "stats.hpp"
+#include <cstring>
+#include <cstdio>
+#include <iomanip>
+#include <sys/mman.h>
+
+/*----------------latencyHistogram Class-------------------------------*/
+
+latencyHistogram::latencyHistogram() : totalCount(0), maxValue(0) {
+    std::memset(this->counts, 0, sizeof(this->counts));
+}
+
+/*
+ * bucketUpperBound - the highest value that lands in the given bucket, the inverse of bucketIndex()
+ */
+uint64_t latencyHistogram::bucketUpperBound(int index) {
+    if (index < SUB_BUCKET_COUNT)
+        return static_cast<uint64_t>(index);
+
+    int shift = index / SUB_BUCKET_COUNT - 1;
+    uint64_t subBucket = static_cast<uint64_t>(index % SUB_BUCKET_COUNT);
+    return ((SUB_BUCKET_COUNT + subBucket + 1) << shift) - 1;
+}
+
+uint64_t latencyHistogram::percentile(double percent) const {
+    if (!this->totalCount)
+        return 0;
+
+    // The rank of the wanted value, rounded up, so the 99th percentile of 10 values is the 10th one
+    uint64_t rank = static_cast<uint64_t>(percent / 100.0 * this->totalCount);
+    if (rank < percent / 100.0 * this->totalCount)
+        rank++;
+    if (!rank)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        seen += this->counts[i];
+        if (seen >= rank) {
+            uint64_t upperBound = bucketUpperBound(i);
+            return (upperBound < this->maxValue) ? upperBound : this->maxValue;
+        }
+    }
+    return this->maxValue;
+}
+
+
+/*----------------latencyStats Class-------------------------------*/
+
+std::map<std::string, std::unique_ptr<latencyStats::executableStats>> latencyStats::executables;
+std::map<std::string, std::unique_ptr<latencyHistogram>> latencyStats::nodes;
+
+/*
+ * The exec stamps, a table in memory shared by the shell and all of its children
+ * A child writes its stamp in the slot of its pid, the shell reads it back after reaping the child
+ * Two live children whose pids collide on a slot only cost one missing sample, never a wrong one, since the pid is checked
+ */
+#define EXEC_SLOT_COUNT 1024
+
+struct execSlot {
+    volatile pid_t pid;
+    volatile uint64_t timestamp;
+};
+
+static execSlot *execSlots = nullptr;
+
+void latencyStats::prepareSpawn() {
+    if (execSlots)
+        return;
+
+    void *mapping = mmap(nullptr, sizeof(execSlot) * EXEC_SLOT_COUNT, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mapping != MAP_FAILED)
+        execSlots = static_cast<execSlot *>(mapping);
+}
+
+void latencyStats::markExec() {
+    if (!execSlots)
+        return;
+
+    pid_t pid = getpid();
+    execSlot &slot = execSlots[pid % EXEC_SLOT_COUNT];
+    slot.timestamp = now();
+    slot.pid = pid;
+}
+
+bool latencyStats::execTimestamp(pid_t pid, uint64_t &timestamp) {
+    if (!execSlots)
+        return false;
+
+    execSlot &slot = execSlots[pid % EXEC_SLOT_COUNT];
+    if (slot.pid != pid)
+        return false;
+    timestamp = slot.timestamp;
+    slot.pid = 0;
+    return true;
+}
+
+/*
+ * recordChild - the exec stamp splits the child's life in two, if the child died before execve() there is no stamp and only the wait counts
+ */
+void latencyStats::recordChild(const std::string &name, pid_t pid, uint64_t forkTime, uint64_t waitStart, uint64_t reapTime) {
+    executableStats &stats = executable(name);
+    uint64_t execTime;
+    if (execTimestamp(pid, execTime)) {
+        stats.spawn.record(execTime - forkTime);
+        stats.run.record(reapTime - execTime);
+    }
+    stats.wait.record(reapTime - waitStart);
+}
+
+latencyStats::executableStats &latencyStats::executable(const std::string &name) {
+    std::unique_ptr<executableStats> &stats = executables[name];
+    if (!stats)
+        stats.reset(new executableStats());
+    return *stats;
+}
+
+latencyHistogram &latencyStats::node(const std::string &type) {
+    std::unique_ptr<latencyHistogram> &histogram = nodes[type];
+    if (!histogram)
+        histogram.reset(new latencyHistogram());
+    return *histogram;
+}
+
+/*
+ * reset - zeroes every histogram, the histograms themselves stay where they are since callers cache references to them
+ */
+void latencyStats::reset() {
+    for (auto &entry : executables)
+        *entry.second = executableStats();
+    for (auto &entry : nodes)
+        *entry.second = latencyHistogram();
+}
+
+/*
+ * formatDuration - nanoseconds in the most readable unit, "850ns", "12.4us", "3.1ms", "2.0s"
+ */
+static std::string formatDuration(uint64_t nanoseconds) {
+    char buffer[32];
+
+    if (nanoseconds < 1000)
+        snprintf(buffer, sizeof(buffer), "%lluns", static_cast<unsigned long long>(nanoseconds));
+    else if (nanoseconds < 1000000)
+        snprintf(buffer, sizeof(buffer), "%.1fus", nanoseconds / 1e3);
+    else if (nanoseconds < 1000000000)
+        snprintf(buffer, sizeof(buffer), "%.1fms", nanoseconds / 1e6);
+    else
+        snprintf(buffer, sizeof(buffer), "%.1fs", nanoseconds / 1e9);
+    return buffer;
+}
+
+static void printRow(std::ostream &output, const std::string &name, const std::string &phase, const latencyHistogram &histogram) {
+    output << std::left << std::setw(20) << name << std::setw(10) << phase << std::right
+        << std::setw(10) << histogram.count()
+        << std::setw(10) << formatDuration(histogram.percentile(50))
+        << std::setw(10) << formatDuration(histogram.percentile(99))
+        << std::setw(10) << formatDuration(histogram.max()) << std::endl;
+}
+
+void latencyStats::print(std::ostream &output) {
+    output << std::left << std::setw(20) << "EXECUTABLE" << std::setw(10) << "PHASE" << std::right
+        << std::setw(10) << "COUNT" << std::setw(10) << "P50" << std::setw(10) << "P99" << std::setw(10) << "MAX" << std::endl;
+    for (const auto &entry : executables) {
+        printRow(output, entry.first, "spawn", entry.second->spawn);
+        printRow(output, entry.first, "run", entry.second->run);
+        printRow(output, entry.first, "wait", entry.second->wait);
+    }
+
+    output << std::endl << std::left << std::setw(20) << "NODE" << std::setw(10) << "" << std::right
+        << std::setw(10) << "COUNT" << std::setw(10) << "P50" << std::setw(10) << "P99" << std::setw(10) << "MAX" << std::endl;
+    for (const auto &entry : nodes)
+        printRow(output, entry.first, "execute", *entry.second);
+}
+
+/*
+ * JSON output, for scraping, all durations are in nanoseconds
+ */
+static std::string jsonString(const std::string &text) {
+    std::string escaped = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            char buffer[8];
+            snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+            escaped += buffer;
+        }
+        else {
+            escaped += c;
+        }
+    }
+    return escaped + "\"";
+}
+
+static void printJsonHistogram(std::ostream &output, const latencyHistogram &histogram) {
+    output << "{\"count\":" << histogram.count()
+        << ",\"p50_ns\":" << histogram.percentile(50)
+        << ",\"p99_ns\":" << histogram.percentile(99)
+        << ",\"max_ns\":" << histogram.max() << "}";
+}
+
+void latencyStats::printJson(std::ostream &output) {
+    output << "{\"executables\":{";
+    for (auto entry = executables.begin(); entry != executables.end(); ++entry) {
+        output << (entry == executables.begin() ? "" : ",") << jsonString(entry->first) << ":{\"spawn\":";
+        printJsonHistogram(output, entry->second->spawn);
+        output << ",\"run\":";
+        printJsonHistogram(output, entry->second->run);
+        output << ",\"wait\":";
+        printJsonHistogram(output, entry->second->wait);
+        output << "}";
+    }
+
+    output << "},\"nodes\":{";
+    for (auto entry = nodes.begin(); entry != nodes.end(); ++entry) {
+        output << (entry == nodes.begin() ? "" : ",") << jsonString(entry->first) << ":";
+        printJsonHistogram(output, *entry->second);
+    }
+    output << "}}" << std::endl;
+}
@@ -0,0 +1,111 @@
+#ifndef __STATS__
+#define __STATS__
+
+#include <iostream>
+#include <string>
+#include <map>
+#include <memory>
+#include <cstdint>
+#include <ctime>
+#include <unistd.h>
+
+/*
+ * latencyHistogram - an HDR style histogram of nanosecond latencies
+ * Values are bucketed log-linearly: every power of two is split into 32 equal sub-buckets, which bounds the error to ~3%
+ * from nanoseconds to centuries, with a fixed array and no allocation, recording is a count-leading-zeros and a few adds
+ */
+class latencyHistogram {
+    private:
+        static const int SUB_BUCKET_BITS = 5;
+        static const int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+        static const int BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+        uint64_t counts[BUCKET_COUNT];
+        uint64_t totalCount;
+        uint64_t maxValue;
+
+        // Values below 32 get a bucket each, above that, the position of the highest bit picks the power of two
+        // and the next five bits pick the sub-bucket inside it
+        static int bucketIndex(uint64_t value) {
+            if (value < SUB_BUCKET_COUNT)
+                return static_cast<int>(value);
+            int shift = (63 - __builtin_clzll(value)) - SUB_BUCKET_BITS;
+            return (shift + 1) * SUB_BUCKET_COUNT + static_cast<int>((value >> shift) - SUB_BUCKET_COUNT);
+        }
+        static uint64_t bucketUpperBound(int index);
+
+    public:
+        latencyHistogram();
+
+        void record(uint64_t value) {
+            this->counts[bucketIndex(value)]++;
+            this->totalCount++;
+            if (value > this->maxValue)
+                this->maxValue = value;
+        }
+
+        // The smallest recorded value that the given percentage of the values are below or equal to, within the bucket precision
+        uint64_t percentile(double percent) const;
+        uint64_t count() const { return this->totalCount; }
+        uint64_t max() const { return this->maxValue; }
+};
+
+/*
+ * latencyStats - every latency the shell measures, printed by the "stats" built-in
+ * Per executable, three phases are tracked:
+ *     spawn - from fork() to the moment the child calls execve()
+ *     run   - from execve() until the child was reaped
+ *     wait  - how long the shell itself was blocked waiting for the child
+ * Per node type (simple, pipe, and...), the wall time of the whole execute() call
+ */
+class latencyStats {
+    public:
+        struct executableStats {
+            latencyHistogram spawn;
+            latencyHistogram run;
+            latencyHistogram wait;
+        };
+
+    private:
+        static std::map<std::string, std::unique_ptr<executableStats>> executables;
+        static std::map<std::string, std::unique_ptr<latencyHistogram>> nodes;
+
+    public:
+        static uint64_t now() {
+            struct timespec current;
+            clock_gettime(CLOCK_MONOTONIC, &current);
+            return static_cast<uint64_t>(current.tv_sec) * 1000000000ULL + current.tv_nsec;
+        }
+
+        // The histograms live as long as the shell, so the references can be cached by the callers
+        static executableStats &executable(const std::string &name);
+        static latencyHistogram &node(const std::string &type);
+
+        // The child side of the spawn measurement, stamps the current time in memory shared with the shell, right before execve()
+        static void markExec();
+        // The shell side, finds the stamp the given child left, returns false if there is none
+        static bool execTimestamp(pid_t pid, uint64_t &timestamp);
+        // Sets up the shared memory, must run in the shell before the fork() whose child calls markExec()
+        static void prepareSpawn();
+        // Records the three phases of a reaped child under the given executable name
+        static void recordChild(const std::string &name, pid_t pid, uint64_t forkTime, uint64_t waitStart, uint64_t reapTime);
+
+        static void print(std::ostream &output);
+        static void printJson(std::ostream &output);
+        static void reset();
+};
+
+/*
+ * latencyScope - records the lifetime of the scope in the given histogram
+ */
+class latencyScope {
+    private:
+        latencyHistogram &histogram;
+        uint64_t start;
+
+    public:
+        latencyScope(latencyHistogram &givenHistogram) : histogram(givenHistogram), start(latencyStats::now()) {}
+        ~latencyScope() { this->histogram.record(latencyStats::now() - this->start); }
+};
+
+#endif
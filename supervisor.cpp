@@ -0,0 +1,217 @@
+#include "supervisor.hpp"
+#include "stats.hpp"
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cmath>
+#include <climits>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+// The epoll tag of the timerfd, children are tagged with their index which can never reach this
+#define TIMER_TAG UINT32_MAX
+
+long long childSupervisor::defaultTimeout = 0;
+
+void childSupervisor::setDefaultTimeout(long long timeout) {
+    defaultTimeout = timeout;
+}
+
+long long childSupervisor::getDefaultTimeout() {
+    return defaultTimeout;
+}
+
+/*
+ * parseDuration - strtod() also takes "inf", "nan" and huge exponents, none of them is a duration
+ * and converting them to long long is undefined, so anything that doesn't fit in a long long of milliseconds is refused
+ */
+bool childSupervisor::parseDuration(const std::string &duration, long long &milliseconds) {
+    char *end;
+    double value = std::strtod(duration.c_str(), &end);
+    std::string unit(end);
+
+    if (end == duration.c_str() || !std::isfinite(value) || value < 0)
+        return false;
+
+    double scale;
+    if (unit == "ms")
+        scale = 1;
+    else if (unit.empty() || unit == "s")
+        scale = 1000;
+    else if (unit == "m")
+        scale = 60 * 1000;
+    else if (unit == "h")
+        scale = 60 * 60 * 1000;
+    else
+        return false;
+
+    // LLONG_MAX + 1 is a power of two, exact as a double, everything below it converts safely
+    double scaled = value * scale;
+    if (!(scaled < static_cast<double>(LLONG_MAX)))
+        return false;
+    milliseconds = static_cast<long long>(scaled);
+    return true;
+}
+
+/*
+ * signalChildren - sends the signal to every child that is still running
+ * A child leading its own process group (the "timeout" built-in puts it there, and so does the shell under a default timeout) gets it sent to the whole group,
+ * that way the grandchildren, like the stages of a timed out pipe, go down with it
+ */
+void childSupervisor::signalChildren(const std::vector<pid_t> &pids, const std::vector<bool> &finished, int signalNumber) {
+    for (size_t i = 0; i < pids.size(); i++) {
+        if (finished[i])
+            continue;
+        if (getpgid(pids[i]) == pids[i])
+            kill(-pids[i], signalNumber);
+        else
+            kill(pids[i], signalNumber);
+    }
+}
+
+/*
+ * blockingWait - the fallback for kernels without pidfd_open(), plain blocking waitpid() calls and no timeout
+ */
+void childSupervisor::blockingWait(const std::vector<pid_t> &pids, std::vector<int> &statuses, std::vector<bool> &finished,
+        std::vector<uint64_t> *reapTimes) {
+    for (size_t i = 0; i < pids.size(); i++) {
+        if (finished[i])
+            continue;
+        while (waitpid(pids[i], &statuses[i], 0) == -1 && errno == EINTR)
+            ;
+        finished[i] = true;
+        if (reapTimes)
+            (*reapTimes)[i] = latencyStats::now();
+    }
+}
+
+bool childSupervisor::waitForChild(pid_t pid, int &status, long long timeout) {
+    std::vector<pid_t> pids(1, pid);
+    std::vector<int> statuses;
+
+    bool inTime = waitForChildren(pids, statuses, timeout);
+    status = statuses[0];
+    return inTime;
+}
+
+/*
+ * waitForChildren - the supervision loop
+ * pidfds become readable when their process exits, so one epoll_wait() covers any number of children,
+ * and the timerfd joins the same loop to enforce the deadline without any signal handler
+ */
+bool childSupervisor::waitForChildren(const std::vector<pid_t> &pids, std::vector<int> &statuses, long long timeout,
+        std::vector<uint64_t> *reapTimes) {
+    std::vector<bool> finished(pids.size(), false);
+    std::vector<int> pidFds(pids.size(), -1);
+    statuses.assign(pids.size(), 0);
+    if (reapTimes)
+        reapTimes->assign(pids.size(), 0);
+
+    if (timeout < 0)
+        timeout = defaultTimeout;
+
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd == -1) {
+        blockingWait(pids, statuses, finished, reapTimes);
+        return true;
+    }
+
+    // Register every child, if the kernel is too old for pidfds, fall back to blocking waits
+    size_t running = 0;
+    for (size_t i = 0; i < pids.size(); i++) {
+        pidFds[i] = static_cast<int>(syscall(SYS_pidfd_open, pids[i], 0));
+        if (pidFds[i] == -1) {
+            for (size_t j = 0; j < i; j++)
+                close(pidFds[j]);
+            close(epollFd);
+            blockingWait(pids, statuses, finished, reapTimes);
+            return true;
+        }
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u32 = static_cast<uint32_t>(i);
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, pidFds[i], &event);
+        running++;
+    }
+
+    // The deadline, only armed if there is one
+    int timerFd = -1;
+    if (timeout > 0) {
+        timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+
+        struct itimerspec deadline = {};
+        deadline.it_value.tv_sec = timeout / 1000;
+        deadline.it_value.tv_nsec = (timeout % 1000) * 1000000;
+        timerfd_settime(timerFd, 0, &deadline, nullptr);
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u32 = TIMER_TAG;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &event);
+    }
+
+    bool inTime = true;
+    while (running) {
+        struct epoll_event events[16];
+        int readyCount = epoll_wait(epollFd, events, 16, -1);
+
+        if (readyCount == -1) {
+            if (errno == EINTR)
+                continue;
+            // Something is really wrong with epoll, make sure we never leave a zombie behind
+            blockingWait(pids, statuses, finished, reapTimes);
+            break;
+        }
+
+        for (int i = 0; i < readyCount; i++) {
+            uint32_t tag = events[i].data.u32;
+
+            // The timer fired, the first time it's a polite SIGTERM, the second time, after the grace period, it's SIGKILL
+            if (tag == TIMER_TAG) {
+                uint64_t expirations;
+                if (read(timerFd, &expirations, sizeof(expirations)) == -1)
+                    continue;
+
+                if (inTime) {
+                    inTime = false;
+                    signalChildren(pids, finished, SIGTERM);
+
+                    struct itimerspec grace = {};
+                    grace.it_value.tv_sec = KILL_GRACE_PERIOD / 1000;
+                    grace.it_value.tv_nsec = (KILL_GRACE_PERIOD % 1000) * 1000000;
+                    timerfd_settime(timerFd, 0, &grace, nullptr);
+                }
+                else {
+                    signalChildren(pids, finished, SIGKILL);
+                }
+                continue;
+            }
+
+            // A child exited, reap it right away so it doesn't linger as a zombie
+            if (!finished[tag] && waitpid(pids[tag], &statuses[tag], WNOHANG) > 0) {
+                finished[tag] = true;
+                if (reapTimes)
+                    (*reapTimes)[tag] = latencyStats::now();
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, pidFds[tag], nullptr);
+                running--;
+            }
+        }
+    }
+
+    for (int pidFd : pidFds)
+        close(pidFd);
+    if (timerFd != -1)
+        close(timerFd);
+    close(epollFd);
+
+    return inTime;
+}
@@ -0,0 +1,44 @@
+#ifndef __SUPERVISOR__
+#define __SUPERVISOR__
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/types.h>
+
+/*
+ * childSupervisor - the one place where the shell waits for its children
+ * Each child gets a pidfd, and a single epoll loop waits on all of them plus a timerfd for the deadline
+ * When the deadline passes, the children (their whole process group if they lead one) get SIGTERM, and SIGKILL after a grace period
+ */
+class childSupervisor {
+    private:
+        // The timeout applied to every wait that doesn't ask for its own, in milliseconds, 0 means no timeout at all
+        static long long defaultTimeout;
+
+        static void signalChildren(const std::vector<pid_t> &pids, const std::vector<bool> &finished, int signalNumber);
+        static void blockingWait(const std::vector<pid_t> &pids, std::vector<int> &statuses, std::vector<bool> &finished,
+                std::vector<uint64_t> *reapTimes);
+
+    public:
+        // How long the children get to clean up after SIGTERM before they are SIGKILLed
+        static const long long KILL_GRACE_PERIOD = 2000;
+
+        // Waits for all the given children and stores their waitpid() statuses, in the same order
+        // A negative timeout means the default timeout, 0 means none
+        // Returns false if the deadline passed and the children had to be killed
+        // If reapTimes is given, it gets the latencyStats::now() at which each child was reaped, in the same order
+        static bool waitForChildren(const std::vector<pid_t> &pids, std::vector<int> &statuses, long long timeout = -1,
+                std::vector<uint64_t> *reapTimes = nullptr);
+        static bool waitForChild(pid_t pid, int &status, long long timeout = -1);
+
+        static void setDefaultTimeout(long long timeout);
+        static long long getDefaultTimeout();
+
+        // Parses durations like "30", "30s", "500ms", "2m" or "1.5h" into milliseconds
+        static bool parseDuration(const std::string &duration, long long &milliseconds);
+};
+
+#endif
@@ -0,0 +1,81 @@
+#!/bin/sh
+# Equivalence of the optimizer: every line below runs twice, as parsed (--no-optimize) and as optimized,
+# each time in a fresh directory with the same files, and the stdout, the exit status and the files left behind must match
+# Usage: tests/optimizer.sh [KAMISH]
+KAMISH=$(cd "$(dirname "${1:-./kamish}")" && pwd)/$(basename "${1:-./kamish}")
+WORKDIR=$(mktemp -d /tmp/kamish-optimizer.XXXXXX)
+trap 'rm -rf "$WORKDIR"' EXIT
+FAILURES=0
+
+# run MODE LINE - runs LINE in $WORKDIR/MODE, prints its stdout, its status and the files it left behind
+run() {
+    rm -rf "$WORKDIR/$1"
+    mkdir -p "$WORKDIR/$1/subdir"
+    cd "$WORKDIR/$1" || exit 1
+    printf 'one include\ntwo\nthree include\n' > in.txt
+    printf 'zeta\nalpha\n' > other.txt
+    touch unreadable.txt
+    chmod 000 unreadable.txt
+
+    if [ "$1" = plain ]; then
+        "$KAMISH" --norc --no-optimize -c "$2" 2>/dev/null
+    else
+        "$KAMISH" --norc -c "$2" 2>/dev/null
+    fi
+    echo "status $?"
+    for file in *.txt; do
+        [ -r "$file" ] && echo "$file: $(cksum < "$file")"
+    done
+    cd / || exit 1
+}
+
+while IFS= read -r line; do
+    [ -z "$line" ] && continue
+    plain=$(run plain "$line")
+    optimized=$(run optimized "$line")
+    if [ "$plain" = "$optimized" ]; then
+        echo "ok      $line"
+    else
+        echo "FAILED  $line"
+        echo "--- --no-optimize:"
+        echo "$plain"
+        echo "--- optimized:"
+        echo "$optimized"
+        FAILURES=$((FAILURES + 1))
+    fi
+done <<'LINES'
+cat in.txt | wc -l
+cat in.txt | grep include | wc -l
+cat in.txt | sort -r
+cat in.txt | grep nothing
+cat in.txt | sort < other.txt
+cat in.txt | tr a-z A-Z > out.txt
+cat in.txt | cat | cat | wc -c
+cat missing.txt | wc -c
+cat subdir | wc -c
+cat unreadable.txt | wc -c
+rm in.txt ; cat in.txt | wc -c
+cp other.txt late.txt ; cat late.txt | sort
+true && echo yes
+false && echo never
+false || echo fallback
+true || echo never
+true ; echo after
+: && echo colon
+false
+true
+:
+false && true || echo chain
+true && true && false || echo nested
+false ; false && echo never
+sort < in.txt > out.txt
+sort < in.txt >> out.txt ; sort < other.txt >> out.txt
+wc -l < missing.txt > out.txt
+cat in.txt | sort > out.txt ; cat out.txt
+LINES
+
+if [ "$FAILURES" -ne 0 ]; then
+    echo "$FAILURES line(s) behave differently once optimized"
+    exit 1
+fi
+echo "all lines behave the same with and without the optimizer"